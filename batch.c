@@ -0,0 +1,53 @@
+#include "batch.h"
+
+void spriteBatchInit(struct SpriteBatch* batch, SDL_Renderer* renderer) {
+    batch->renderer = renderer;
+    batch->texture = NULL;
+    batch->size = 0;
+
+    for (size_t i = 0; i < SPRITE_BATCH_SIZE; i++) {
+        int* idx = &batch->indices[6*i];
+        int first = 4*i;
+        idx[0] = first;
+        idx[1] = first + 1;
+        idx[2] = first + 2;
+        idx[3] = first;
+        idx[4] = first + 2;
+        idx[5] = first + 3;
+    }
+}
+
+void spriteBatchFlush(struct SpriteBatch* batch) {
+    if (batch->size == 0) return;
+
+    SDL_RenderGeometry(batch->renderer, batch->texture, batch->vertices, 4*batch->size, batch->indices, 6*batch->size);
+    batch->size = 0;
+}
+
+// src is the whole texture when NULL
+void spriteBatchCopy(struct SpriteBatch* batch, SDL_Texture* texture, SDL_Rect* src, SDL_Rect* dest, SDL_Color color) {
+    if (texture != batch->texture || batch->size == SPRITE_BATCH_SIZE) {
+        spriteBatchFlush(batch);
+    }
+    if (texture != batch->texture) {
+        batch->texture = texture;
+        SDL_QueryTexture(texture, NULL, NULL, &batch->texture_w, &batch->texture_h);
+    }
+
+    float u0 = 0;
+    float v0 = 0;
+    float u1 = 1;
+    float v1 = 1;
+    if (src) {
+        u0 = (float)src->x / batch->texture_w;
+        v0 = (float)src->y / batch->texture_h;
+        u1 = (float)(src->x + src->w) / batch->texture_w;
+        v1 = (float)(src->y + src->h) / batch->texture_h;
+    }
+
+    SDL_Vertex* v = &batch->vertices[4*batch->size++];
+    v[0] = (SDL_Vertex){{dest->x, dest->y}, color, {u0, v0}};
+    v[1] = (SDL_Vertex){{dest->x + dest->w, dest->y}, color, {u1, v0}};
+    v[2] = (SDL_Vertex){{dest->x + dest->w, dest->y + dest->h}, color, {u1, v1}};
+    v[3] = (SDL_Vertex){{dest->x, dest->y + dest->h}, color, {u0, v1}};
+}
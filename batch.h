@@ -0,0 +1,38 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__linux__)
+#include <SDL2/SDL.h>
+#else
+#include <SDL.h>
+#endif
+
+// Quads per draw call, a full batch is drawn before taking more
+#define SPRITE_BATCH_SIZE 2048
+
+/*
+ * Quads collected into one vertex array and drawn with a single
+ * SDL_RenderGeometry per run of the same texture, instead of a call per
+ * sprite. Each quad's colour is multiplied with its texture, so a white
+ * patch of the texture fills with any colour without breaking the run.
+ * */
+struct SpriteBatch {
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    int texture_w;
+    int texture_h;
+
+    SDL_Vertex vertices[4*SPRITE_BATCH_SIZE];
+    // The same two triangles for every quad, set once
+    int indices[6*SPRITE_BATCH_SIZE];
+    size_t size;
+};
+
+void spriteBatchInit(struct SpriteBatch* batch, SDL_Renderer* renderer);
+void spriteBatchCopy(struct SpriteBatch* batch, SDL_Texture* texture, SDL_Rect* src, SDL_Rect* dest, SDL_Color color);
+void spriteBatchFlush(struct SpriteBatch* batch);
+
+#endif // BATCH_H
@@ -0,0 +1,530 @@
+/*
+ * bots: a load generator for a host or a dedicated server.
+ *
+ * Opens many client connections without a window. Each one joins as a
+ * player or a spectator, plays by a pattern once its match starts and takes
+ * every state the host sends. At the end it reports what the clients saw:
+ * bandwidth, input latency, round trip time and the host's own tick times,
+ * so runs with the same options can be compared.
+ *
+ * With --local, they connect to a server on the same machine through shared
+ * memory instead of TCP, see shm.h.
+ * */
+#if defined(__linux__)
+// poll, clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "game.h"
+#include "proto.h"
+#include "shm.h"
+
+enum Pattern {
+    PATTERN_RANDOM,
+    PATTERN_CIRCLE,
+    PATTERN_SCRIPT,
+};
+
+struct Bot {
+    struct Conn conn;
+    // NULL over TCP, owned by conn
+    struct ShmConn* shm;
+    enum Role role;
+    size_t player_i;
+    bool welcomed;
+    bool running;
+
+    struct InputHistory inputs;
+    uint32_t next_input;
+    size_t script_i;
+
+    // Newest state taken
+    uint32_t tick;
+    uint64_t states;
+    struct MatchClock match_clock;
+    uint32_t input_delay;
+};
+
+// Grows as needed, sorted when a percentile is asked for
+struct Samples {
+    uint32_t* data;
+    size_t size;
+    size_t capacity;
+};
+
+struct Options {
+    size_t clients;
+    size_t spectators;
+    uint32_t duration;
+    enum Pattern pattern;
+    char* script;
+    uint32_t input_delay;
+} options = {
+    .clients = 100,
+    .spectators = 0,
+    .duration = 10000,
+    .pattern = PATTERN_RANDOM,
+    .script = "RDLU",
+    .input_delay = 1000 / 4,
+};
+
+struct Bot** bots;
+size_t bots_size;
+
+struct Samples input_latencies;
+// How long states took to arrive, by the synced clock
+struct Samples state_ages;
+struct TickStats* host_ticks;
+size_t host_ticks_size;
+size_t host_ticks_capacity;
+
+void usage(char* program) {
+    fprintf(stderr,
+        "usage: %s HOST_IP PORT [options]\n"
+        "       %s --local PATH [options]\n"
+        "\n"
+        "    --clients N          players to connect (default 100)\n"
+        "    --spectators N       spectators to connect (default 0)\n"
+        "    --duration S         how long to play (default 10)\n"
+        "    --pattern NAME       random, circle or script (default random)\n"
+        "    --script DIRS        directions to cycle through for script, from DLRU (default RDLU)\n"
+        "    --input-rate HZ      inputs per second per player (default 4)\n"
+        "    --seed N\n",
+        program, program
+    );
+    exit(EXIT_FAILURE);
+}
+
+uint32_t parseNum(char* program, char* str, uint32_t min, uint32_t max) {
+    char* end;
+    long num = strtol(str, &end, 10);
+
+    if (*str == '\0' || *end != '\0' || num < (long)min || (unsigned long)num > max) {
+        fprintf(stderr, "Invalid number: %s\n", str);
+        usage(program);
+    }
+
+    return num;
+}
+
+bool parseDirection(char c, enum Direction* direc) {
+    switch (c) {
+    case 'D': *direc = DOWN; return true;
+    case 'L': *direc = LEFT; return true;
+    case 'R': *direc = RIGHT; return true;
+    case 'U': *direc = UP; return true;
+    default: return false;
+    }
+}
+
+void samplesAdd(struct Samples* samples, uint32_t sample) {
+    if (samples->size == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity*2 : 1024;
+        samples->data = pcp(realloc(samples->data, samples->capacity*sizeof(uint32_t)), "realloc failed");
+    }
+    samples->data[samples->size++] = sample;
+}
+
+int compareU32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+void samplesSort(struct Samples* samples) {
+    qsort(samples->data, samples->size, sizeof(uint32_t), compareU32);
+}
+
+// Samples must be sorted
+uint32_t samplesPercentile(struct Samples* samples, size_t percent) {
+    if (samples->size == 0) return 0;
+
+    size_t i = samples->size*percent/100;
+    if (i >= samples->size) i = samples->size - 1;
+    return samples->data[i];
+}
+
+void hostTicksAdd(struct TickStats* stats) {
+    if (host_ticks_size == host_ticks_capacity) {
+        host_ticks_capacity = host_ticks_capacity ? host_ticks_capacity*2 : 256;
+        host_ticks = pcp(realloc(host_ticks, host_ticks_capacity*sizeof(struct TickStats)), "realloc failed");
+    }
+    host_ticks[host_ticks_size++] = *stats;
+}
+
+// Through shared memory when local_path is set
+struct Bot* botConnect(struct sockaddr_in* addr, char* local_path, enum Role role) {
+    struct Bot* bot = pcp(calloc(1, sizeof(*bot)), "calloc failed");
+    bot->role = role;
+
+    if (local_path) {
+        bot->shm = shmConnect(local_path);
+        if (!bot->shm) {
+            fprintf(stderr, "Connection failed: %s\n", local_path);
+            free(bot);
+            return NULL;
+        }
+
+        connInit(&bot->conn, bot->shm->fd);
+        shmAttach(bot->shm, &bot->conn);
+    } else {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        pcr(fd, "Socket creation failed");
+
+        if (connect(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+            perror("Connection failed");
+            closeFd(fd);
+            free(bot);
+            return NULL;
+        }
+        unblock(fd);
+        connInit(&bot->conn, fd);
+    }
+
+    uint8_t data = role;
+    connSend(&bot->conn, MSG_JOIN, &data, sizeof(data));
+
+    return bot;
+}
+
+enum Direction botNextDirection(struct Bot* bot) {
+    switch (options.pattern) {
+    case PATTERN_RANDOM: {
+        return (enum Direction)(rand() % 4);
+    } break;
+    case PATTERN_CIRCLE: {
+        enum Direction circle[4] = {RIGHT, DOWN, LEFT, UP};
+        return circle[bot->script_i++ % 4];
+    } break;
+    case PATTERN_SCRIPT: {
+        enum Direction direc = RIGHT;
+        parseDirection(options.script[bot->script_i++ % strlen(options.script)], &direc);
+        return direc;
+    } break;
+    }
+
+    return RIGHT;
+}
+
+void botRecv(struct Bot* bot, uint32_t now) {
+    if (!connRecv(&bot->conn, now)) return;
+
+    struct Msg msg;
+    while (connNextMsg(&bot->conn, &msg)) {
+        switch (msg.type) {
+        case MSG_WELCOME: {
+            uint8_t player_i;
+            uint8_t token[SESSION_TOKEN_SIZE];
+            if (welcomeRead(&msg, &player_i, token)) {
+                bot->welcomed = true;
+                bot->role = player_i == SPECTATOR_I ? ROLE_SPECTATOR : ROLE_PLAYER;
+                bot->player_i = player_i;
+            }
+        } break;
+        case MSG_START_GAME: {
+            bot->running = true;
+            bot->tick = 0;
+            bot->match_clock.started = false;
+            startGameRead(&msg, &bot->input_delay);
+        } break;
+        case MSG_STATE: {
+            uint32_t tick;
+            uint32_t time;
+            if (!stateTick(&msg, &tick) || !stateTime(&msg, &time)) break;
+
+            if (tick < bot->tick) bot->conn.stats.snapshots_skipped++;
+            bot->tick = tick;
+            bot->states++;
+
+            matchClockUpdate(&bot->match_clock, tick, time);
+            if (bot->conn.clock.synced) {
+                samplesAdd(&state_ages, matchClockAge(&bot->match_clock, connRemoteTime(&bot->conn, now)));
+            }
+
+            uint32_t ack;
+            if (bot->role == ROLE_PLAYER && stateInputAck(&msg, bot->player_i, &ack)) {
+                uint32_t latencies[INPUT_HISTORY_SIZE];
+                size_t acked = inputHistoryAck(&bot->inputs, &bot->conn, ack, now, latencies);
+                for (size_t i = 0; i < acked; i++) {
+                    samplesAdd(&input_latencies, latencies[i]);
+                }
+            }
+        } break;
+        case MSG_TICK_STATS: {
+            struct TickStats stats;
+            if (tickStatsRead(&msg, &stats)) {
+                hostTicksAdd(&stats);
+            }
+        } break;
+        default: break;
+        }
+    }
+}
+
+void botPlay(struct Bot* bot, uint32_t now) {
+    if (!bot->running || bot->role != ROLE_PLAYER) return;
+    if ((int32_t)(now - bot->next_input) < 0) return;
+
+    bot->next_input = now + options.input_delay;
+
+    uint32_t tick = bot->tick;
+    if (bot->conn.clock.synced) {
+        tick = matchClockTick(&bot->match_clock, connRemoteTime(&bot->conn, now));
+    }
+    inputHistoryAdd(&bot->inputs, &bot->conn, botNextDirection(bot), tick + bot->input_delay, now);
+}
+
+/*
+ * Only a server reached with --local is known to share the bots' clock, so
+ * its offset is an error. Over TCP it may be the game, whose clock starts
+ * with it, and the offset is mostly how long it has been up.
+ * */
+void printReport(uint32_t elapsed, bool same_clock) {
+    struct Samples bytes_in = {0};
+    struct Samples rtts = {0};
+    struct Samples clock_offsets = {0};
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    uint64_t states = 0;
+    uint64_t skipped = 0;
+    size_t players = 0;
+    size_t spectators = 0;
+    size_t closed = 0;
+
+    for (size_t i = 0; i < bots_size; i++) {
+        struct Bot* bot = bots[i];
+
+        if (!bot->conn.open) closed++;
+        if (!bot->welcomed) continue;
+
+        if (bot->role == ROLE_PLAYER) players++;
+        else spectators++;
+
+        total_in += bot->conn.stats.bytes_in;
+        total_out += bot->conn.stats.bytes_out;
+        states += bot->states;
+        skipped += bot->conn.stats.snapshots_skipped;
+
+        samplesAdd(&bytes_in, bot->conn.stats.bytes_in * 1000 / elapsed);
+        if (bot->conn.stats.has_rtt) samplesAdd(&rtts, bot->conn.stats.rtt);
+        if (bot->conn.clock.synced) samplesAdd(&clock_offsets, abs(bot->conn.clock.offset));
+    }
+
+    samplesSort(&bytes_in);
+    samplesSort(&rtts);
+    samplesSort(&input_latencies);
+    samplesSort(&state_ages);
+    samplesSort(&clock_offsets);
+
+    printf("\n%zu connections over %.1fs: %zu players, %zu spectators, %zu closed early\n",
+        bots_size, elapsed / 1000.0, players, spectators, closed);
+    printf("    total in:          %"PRIu64" KB/s\n", total_in * 1000 / elapsed / 1000);
+    printf("    total out:         %"PRIu64" KB/s\n", total_out * 1000 / elapsed / 1000);
+    printf("    per client in:     p50 %"PRIu32" B/s, p99 %"PRIu32" B/s\n",
+        samplesPercentile(&bytes_in, 50), samplesPercentile(&bytes_in, 99));
+    printf("    states:            %.1f/s per client, %"PRIu64" skipped\n",
+        players + spectators ? states * 1000.0 / elapsed / (players + spectators) : 0.0, skipped);
+    printf("    input latency:     p50 %"PRIu32" ms, p90 %"PRIu32" ms, p99 %"PRIu32" ms, max %"PRIu32" ms (%zu inputs)\n",
+        samplesPercentile(&input_latencies, 50), samplesPercentile(&input_latencies, 90),
+        samplesPercentile(&input_latencies, 99), samplesPercentile(&input_latencies, 100),
+        input_latencies.size);
+    printf("    rtt:               p50 %"PRIu32" ms, p99 %"PRIu32" ms\n",
+        samplesPercentile(&rtts, 50), samplesPercentile(&rtts, 99));
+    printf("    state age:         p50 %"PRIu32" ms, p99 %"PRIu32" ms\n",
+        samplesPercentile(&state_ages, 50), samplesPercentile(&state_ages, 99));
+    if (same_clock) {
+        printf("    clock error:       p50 %"PRIu32" ms, max %"PRIu32" ms\n",
+            samplesPercentile(&clock_offsets, 50), samplesPercentile(&clock_offsets, 100));
+    } else {
+        printf("    clock offset:      p50 %"PRIu32" ms, max %"PRIu32" ms (raw, from the host's clock)\n",
+            samplesPercentile(&clock_offsets, 50), samplesPercentile(&clock_offsets, 100));
+    }
+
+    if (host_ticks_size == 0) {
+        printf("    host tick:         not reported\n");
+    } else {
+        // Every client gets the same reports, so the median of them is
+        // what a typical period looked like
+        struct Samples p50s = {0};
+        struct Samples p99s = {0};
+        uint32_t max = 0;
+        for (size_t i = 0; i < host_ticks_size; i++) {
+            samplesAdd(&p50s, host_ticks[i].p50);
+            samplesAdd(&p99s, host_ticks[i].p99);
+            if (host_ticks[i].max > max) max = host_ticks[i].max;
+        }
+        samplesSort(&p50s);
+        samplesSort(&p99s);
+
+        printf("    host tick:         p50 %"PRIu32" us, p99 %"PRIu32" us, max %"PRIu32" us\n",
+            samplesPercentile(&p50s, 50), samplesPercentile(&p99s, 50), max);
+
+        free(p50s.data);
+        free(p99s.data);
+    }
+
+    free(bytes_in.data);
+    free(rtts.data);
+    free(clock_offsets.data);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) usage(argv[0]);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    char* local_path = NULL;
+
+    if (strcmp(argv[1], "--local") == 0) {
+        local_path = argv[2];
+    } else {
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(parseNum(argv[0], argv[2], 1, UINT16_MAX));
+        if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1) {
+            fprintf(stderr, "Invalid IP: %s\n", argv[1]);
+            usage(argv[0]);
+        }
+    }
+
+    unsigned seed = netNow();
+
+    for (int i = 3; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+
+        char* opt = argv[i];
+        char* value = argv[++i];
+
+        if (strcmp(opt, "--clients") == 0) {
+            options.clients = parseNum(argv[0], value, 0, 100000);
+        } else if (strcmp(opt, "--spectators") == 0) {
+            options.spectators = parseNum(argv[0], value, 0, 100000);
+        } else if (strcmp(opt, "--duration") == 0) {
+            options.duration = parseNum(argv[0], value, 1, 86400) * 1000;
+        } else if (strcmp(opt, "--pattern") == 0) {
+            if (strcmp(value, "random") == 0) options.pattern = PATTERN_RANDOM;
+            else if (strcmp(value, "circle") == 0) options.pattern = PATTERN_CIRCLE;
+            else if (strcmp(value, "script") == 0) options.pattern = PATTERN_SCRIPT;
+            else usage(argv[0]);
+        } else if (strcmp(opt, "--script") == 0) {
+            enum Direction direc;
+            for (char* c = value; *c; c++) {
+                if (!parseDirection(*c, &direc)) usage(argv[0]);
+            }
+            if (*value == '\0') usage(argv[0]);
+            options.script = value;
+        } else if (strcmp(opt, "--input-rate") == 0) {
+            options.input_delay = 1000 / parseNum(argv[0], value, 1, 1000);
+        } else if (strcmp(opt, "--seed") == 0) {
+            seed = parseNum(argv[0], value, 0, UINT32_MAX);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", opt);
+            usage(argv[0]);
+        }
+    }
+
+    srand(seed);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+#ifdef WINDOWS
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != NO_ERROR) {
+        fprintf(stderr, "WSAStartup failed: %d\n", WSAGetLastError());
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    size_t total = options.clients + options.spectators;
+    bots = pcp(calloc(total, sizeof(struct Bot*)), "calloc failed");
+
+#if defined(__linux__)
+    struct pollfd* pfds = pcp(calloc(total, sizeof(struct pollfd)), "calloc failed");
+#elif defined(WINDOWS)
+    WSAPOLLFD* pfds = pcp(calloc(total, sizeof(WSAPOLLFD)), "calloc failed");
+#endif
+
+    for (size_t i = 0; i < total; i++) {
+        struct Bot* bot = botConnect(&addr, local_path, i < options.clients ? ROLE_PLAYER : ROLE_SPECTATOR);
+        if (!bot) break;
+
+        // Spread inputs out instead of sending them all at once
+        bot->next_input = netNow() + rand() % options.input_delay;
+        bots[bots_size++] = bot;
+    }
+
+    if (local_path) {
+        printf("Connected %zu/%zu clients to %s (seed %u)\n", bots_size, total, local_path, seed);
+    } else {
+        printf("Connected %zu/%zu clients to %s:%s (seed %u)\n", bots_size, total, argv[1], argv[2], seed);
+    }
+    if (bots_size == 0) exit(EXIT_FAILURE);
+
+    uint32_t start = netNow();
+    uint32_t now = start;
+
+    while (now - start < options.duration) {
+        // Inputs and pings are due every few milliseconds at most
+        int timeout = 5;
+
+        size_t pfds_size = 0;
+        for (size_t i = 0; i < bots_size; i++) {
+            struct Bot* bot = bots[i];
+            pfds[pfds_size].fd = -1;
+            if (bot->conn.open) {
+                pfds[pfds_size].fd = bot->shm ? bot->shm->in_event : bot->conn.fd;
+                if (bot->shm && !shmWaitStart(bot->shm)) timeout = 0;
+            }
+#if defined(__linux__)
+            pfds[pfds_size].events = POLLIN;
+#elif defined(WINDOWS)
+            pfds[pfds_size].events = POLLRDNORM;
+#endif
+            pfds[pfds_size].revents = 0;
+            pfds_size++;
+        }
+
+#if defined(__linux__)
+        poll(pfds, pfds_size, timeout);
+#elif defined(WINDOWS)
+        WSAPoll(pfds, pfds_size, timeout);
+#endif
+
+        now = netNow();
+
+        for (size_t i = 0; i < bots_size; i++) {
+            struct Bot* bot = bots[i];
+            if (!bot->conn.open) continue;
+
+            // Reading shared memory costs nothing, there may be something
+            // even without a wakeup
+            if (bot->shm) shmWaitEnd(bot->shm, pfds[i].revents != 0);
+            if (pfds[i].revents || bot->shm) botRecv(bot, now);
+            botPlay(bot, now);
+            connFlush(&bot->conn, now);
+        }
+    }
+
+    printReport(now - start, local_path != NULL);
+
+    for (size_t i = 0; i < bots_size; i++) {
+        connClose(&bots[i]->conn);
+        free(bots[i]);
+    }
+    free(bots);
+    free(pfds);
+    free(input_latencies.data);
+    free(state_ages.data);
+    free(host_ticks);
+
+#ifdef WINDOWS
+    WSACleanup();
+#endif
+
+    return 0;
+}
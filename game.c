@@ -0,0 +1,264 @@
+#include <stdlib.h>
+
+#include "game.h"
+
+void appleInit(struct Apple* p_apple) {
+    p_apple->pos.x = rand() % GRID_SIZE;
+    p_apple->pos.y = rand() % GRID_SIZE;
+
+    int odds[POWERUP_SIZE];
+    odds[NONE] = 10;
+    odds[ZOMBIE] = 1;
+    odds[SONIC] = 1;
+
+    int total = 0;
+    for (size_t i = 0; i < POWERUP_SIZE; i++) {
+        total += odds[i];
+    }
+
+    int r = rand() % total;
+
+    int accum = 0;
+    for (size_t i = 0; i < POWERUP_SIZE; i++) {
+        if (r < odds[i] + accum) {
+            p_apple->type = (enum Powerup)i;
+            break;
+        }
+        accum += odds[i];
+    }
+}
+
+void appleSpawnerInit(struct AppleSpawner* p_apple_spawner) {
+    for (size_t i = 0; i < p_apple_spawner->apples_size; i++) {
+        appleInit(&p_apple_spawner->apples[i]);
+    }
+    p_apple_spawner->apples_size = 1;
+    p_apple_spawner->last_spawn_frame = 0;
+    p_apple_spawner->spawn_delay = 3000;
+}
+
+void playerInit(struct Player* p_player) {
+    p_player->score = 0;
+    p_player->game_over = false;
+
+    p_player->last_movem_frame = 0;
+    p_player->movem_delay = 250;
+
+    p_player->pos.x = 0;
+    p_player->pos.y = 0;
+
+    p_player->body_size = 0;
+
+    p_player->direc = RIGHT;
+    p_player->direc_size = 0;
+    p_player->direc_i = 0;
+    p_player->reset_buffer_on_input = true;
+
+    p_player->last_input_seq = 0;
+
+    p_player->zombie_end = 0;
+    p_player->zombie_duration = 3000;
+
+    p_player->sonic_end = 0;
+    p_player->sonic_duration = 3000;
+}
+
+void addDirection(struct Player* player, enum Direction direc) {
+    if (player->reset_buffer_on_input) {
+        player->reset_buffer_on_input = false;
+        player->direc_size = 0;
+        player->direc_i = 0;
+    }
+    if (player->direc_size < DIREC_BUFFER_SIZE) {
+        player->direc_buff[player->direc_size++] = direc;
+    }
+}
+
+bool playerHasDirecRoom(struct Player* player) {
+    return player->reset_buffer_on_input || player->direc_size < DIREC_BUFFER_SIZE;
+}
+
+/*
+ * All players must move their heads and bodies before checking collision
+ * */
+void gameStateUpdate(struct GameState* game_state, uint32_t curr_time) {
+    game_state->tick++;
+
+    // Initialize to false
+    bool move[MAX_PLAYERS_SIZE] = {0};
+
+    // Check if player will move
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        if (game_state->players[i].game_over) {
+            continue;
+        }
+
+        uint32_t movem_delay = game_state->players[i].movem_delay;
+        if (curr_time < game_state->players[i].sonic_end) {
+            movem_delay /= 2;
+        }
+
+        if (curr_time - game_state->players[i].last_movem_frame > movem_delay) {
+            move[i] = true;
+        }
+    }
+
+    // Move heads
+    struct Pos last_pos[MAX_PLAYERS_SIZE];
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        if (game_state->players[i].game_over || !move[i]) continue;
+
+        game_state->players[i].last_movem_frame = curr_time;
+        game_state->players[i].reset_buffer_on_input = true;
+
+        // Store last position
+        last_pos[i] = game_state->players[i].pos;
+
+        // Check input in buffer
+        if (game_state->players[i].direc_i < game_state->players[i].direc_size) {
+            game_state->players[i].direc = game_state->players[i].direc_buff[game_state->players[i].direc_i++];
+        }
+
+        // Move
+        switch (game_state->players[i].direc) {
+        case DOWN: {
+            game_state->players[i].pos.y++;
+        } break;
+        case LEFT: {
+            game_state->players[i].pos.x--;
+        } break;
+        case RIGHT: {
+            game_state->players[i].pos.x++;
+        } break;
+        case UP: {
+            game_state->players[i].pos.y--;
+        } break;
+        }
+
+        // Wraparound
+        if (game_state->players[i].pos.x < 0) {
+            game_state->players[i].pos.x = GRID_SIZE-1;
+        } else if (game_state->players[i].pos.x >= GRID_SIZE) {
+            game_state->players[i].pos.x = 0;
+        }
+
+        if (game_state->players[i].pos.y < 0) {
+            game_state->players[i].pos.y = GRID_SIZE-1;
+        } else if (game_state->players[i].pos.y >= GRID_SIZE) {
+            game_state->players[i].pos.y = 0;
+        }
+    }
+
+    // Check apples
+    for (size_t p_i = 0; p_i < game_state->players_size; p_i++) {
+        if (game_state->players[p_i].game_over) continue;
+
+        for (size_t a_i = 0; a_i < game_state->apple_spawner.apples_size; a_i++) {
+            if (game_state->players[p_i].pos.x == game_state->apple_spawner.apples[a_i].pos.x
+                    && game_state->players[p_i].pos.y == game_state->apple_spawner.apples[a_i].pos.y) {
+                game_state->players[p_i].score++;
+
+                switch (game_state->apple_spawner.apples[a_i].type) {
+                case NONE: {
+                } break;
+                case ZOMBIE: {
+                    game_state->players[p_i].zombie_end = curr_time + game_state->players[p_i].zombie_duration;
+                } break;
+                case SONIC: {
+                    game_state->players[p_i].sonic_end = curr_time + game_state->players[p_i].sonic_duration;
+                } break;
+                }
+
+                appleInit(&game_state->apple_spawner.apples[a_i]);
+
+                game_state->players[p_i].body_size++;
+            }
+        }
+    }
+
+    // Move body and zombie
+    for (size_t p_i = 0; p_i < game_state->players_size; p_i++) {
+        if (game_state->players[p_i].game_over || !move[p_i]) continue;
+
+        // Move body
+        if (game_state->players[p_i].body_size > 0) {
+            for (size_t b_i = game_state->players[p_i].body_size-1; b_i > 0; b_i--) {
+                game_state->players[p_i].body[b_i] = game_state->players[p_i].body[b_i-1];
+            }
+            game_state->players[p_i].body[0] = last_pos[p_i];
+        }
+
+        // Add zombie dead body
+        if (curr_time < game_state->players[p_i].zombie_end) {
+            if (game_state->players[p_i].body_size > 0) {
+                game_state->dead_bodies[game_state->dead_bodies_size] = game_state->players[p_i].body[game_state->players[p_i].body_size-1];
+
+                game_state->dead_bodies_size++;
+                game_state->players[p_i].body_size--;
+            }
+        }
+    }
+
+    // Check colision
+    for (size_t this_i = 0; this_i < game_state->players_size; this_i++) {
+        if (game_state->players[this_i].game_over) continue;
+
+        for (size_t other_i = 0; other_i < game_state->players_size; other_i++) {
+            if (this_i != other_i
+                    && game_state->players[this_i].pos.x == game_state->players[other_i].pos.x
+                    && game_state->players[this_i].pos.y == game_state->players[other_i].pos.y) {
+                game_state->players[this_i].game_over = true;
+            }
+
+            for (size_t k = 0; k < game_state->players[other_i].body_size; k++) {
+                struct Pos* p_body = &game_state->players[other_i].body[k];
+
+                if (game_state->players[this_i].pos.x == p_body->x && game_state->players[this_i].pos.y == p_body->y) {
+                    game_state->players[this_i].game_over = true;
+                }
+            }
+        }
+
+        for (size_t d_i = 0; d_i < game_state->dead_bodies_size; d_i++) {
+            if (game_state->players[this_i].pos.x == game_state->dead_bodies[d_i].x
+                && game_state->players[this_i].pos.y == game_state->dead_bodies[d_i].y) {
+                game_state->players[this_i].game_over = true;
+            }
+        }
+    }
+
+    // Spawn apples
+    if (curr_time - game_state->apple_spawner.last_spawn_frame > game_state->apple_spawner.spawn_delay) {
+        game_state->apple_spawner.last_spawn_frame = curr_time;
+        appleInit(&game_state->apple_spawner.apples[game_state->apple_spawner.apples_size++]);
+    }
+}
+
+void reset(struct GameState* game_state) {
+    appleSpawnerInit(&game_state->apple_spawner);
+    for (size_t i = 0; i < MAX_PLAYERS_SIZE; i++) {
+        playerInit(&game_state->players[i]);
+    }
+
+    struct Pos init_pos[MAX_PLAYERS_SIZE] = {
+        {0, 0},
+        {GRID_SIZE-1, 0},
+        {0, GRID_SIZE-1},
+        {GRID_SIZE-1, GRID_SIZE-1}
+    };
+
+    enum Direction init_direc[MAX_PLAYERS_SIZE] = {
+        RIGHT,
+        LEFT,
+        RIGHT,
+        LEFT
+    };
+
+    for (size_t i = 0; i < MAX_PLAYERS_SIZE; i++) {
+        game_state->players[i].pos = init_pos[i];
+        game_state->players[i].direc = init_direc[i];
+    }
+
+    game_state->dead_bodies_size = 0;
+    game_state->tick = 0;
+}
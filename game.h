@@ -0,0 +1,102 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GRID_SIZE 20
+#define BODY_SIZE (GRID_SIZE*GRID_SIZE)
+
+#define MAX_PLAYERS_SIZE 4
+
+#define DIREC_BUFFER_SIZE 2
+#define APPLES_SIZE 1000
+
+#define DEAD_BODIES_SIZE 1000
+
+#define SPEEDUP_RATE 0.05
+#define MIN_MOVEM_DELAY 80
+
+struct Pos {
+    int x;
+    int y;
+};
+
+enum Direction {
+    DOWN,
+    LEFT,
+    RIGHT,
+    UP
+};
+
+#define POWERUP_SIZE 3
+
+enum Powerup {
+    NONE,
+    ZOMBIE,
+    SONIC,
+};
+
+struct Apple {
+    struct Pos pos;
+    enum Powerup type;
+};
+
+struct AppleSpawner {
+    struct Apple apples[APPLES_SIZE];
+    size_t apples_size;
+
+    uint32_t last_spawn_frame;
+    uint32_t spawn_delay;
+};
+
+struct Player {
+    int score;
+    bool game_over;
+
+    uint32_t last_movem_frame;
+    uint32_t movem_delay;
+
+    struct Pos pos;
+    struct Pos body[BODY_SIZE];
+    size_t body_size;
+
+    enum Direction direc;
+    enum Direction direc_buff[DIREC_BUFFER_SIZE];
+    int direc_size;
+    int direc_i;
+    bool reset_buffer_on_input;
+
+    // Newest online input the host has from this player, so its client can
+    // stop resending it
+    uint32_t last_input_seq;
+
+    uint32_t zombie_end;
+    uint32_t zombie_duration;
+
+    uint32_t sonic_end;
+    uint32_t sonic_duration;
+};
+
+struct GameState {
+    struct AppleSpawner apple_spawner;
+    struct Player players[MAX_PLAYERS_SIZE];
+    size_t players_size;
+
+    struct Pos dead_bodies[DEAD_BODIES_SIZE];
+    size_t dead_bodies_size;
+
+    // Number of updates since the match started
+    uint32_t tick;
+};
+
+void appleInit(struct Apple* p_apple);
+void appleSpawnerInit(struct AppleSpawner* p_apple_spawner);
+void playerInit(struct Player* p_player);
+void addDirection(struct Player* player, enum Direction direc);
+bool playerHasDirecRoom(struct Player* player);
+void gameStateUpdate(struct GameState* game_state, uint32_t curr_time);
+void reset(struct GameState* game_state);
+
+#endif // GAME_H
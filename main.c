@@ -8,17 +8,17 @@
 #include <inttypes.h>
 #include <errno.h>
 
-#if defined(_WIN64) || defined(_WIN32)
-#define WINDOWS
-#endif
+#include "game.h"
+#include "proto.h"
+#include "room.h"
+#include "netthread.h"
+#include "text.h"
+#include "batch.h"
+#include "sprites.h"
+#include "pacing.h"
+#include "tribuf.h"
 
 #if defined(__linux__)
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <errno.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_ttf.h>
@@ -26,9 +26,6 @@
 #include <SDL.h>
 #include <SDL_image.h>
 #include <SDL_ttf.h>
-#define WIN32_LEAN_AND_MEAN
-#include <winsock2.h>
-#include <ws2tcpip.h>
 //#pragma comment(lib, "Ws2_32.lib")
 #endif
 
@@ -36,71 +33,40 @@
 
 #define WINDOW_WIDTH 700
 #define WINDOW_HEIGHT 500
-#define GRID_SIZE 20
-#define BODY_SIZE (GRID_SIZE*GRID_SIZE)
-
-#define MAX_PLAYERS_SIZE 4
-
-#define DIREC_BUFFER_SIZE 2
-#define APPLES_SIZE 1000
-
-#define DEAD_BODIES_SIZE 1000
-
-#define SPEEDUP_RATE 0.05
-#define MIN_MOVEM_DELAY 80
 
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 TTF_Font* font = NULL;
-SDL_Texture* head_text = NULL;
-SDL_Texture* body_text = NULL;
+TTF_Font* small_font = NULL;
+struct GlyphAtlas font_atlas;
+struct GlyphAtlas small_font_atlas;
+struct TextCache text_cache;
+struct SpriteBatch board_batch;
+struct SpriteAtlas sprite_atlas;
+// Each player's sprites are multiplied by theirs
+SDL_Color player_tints[MAX_PLAYERS_SIZE] = {
+    {0xFF, 0xFF, 0xFF, 0xFF},
+    {0xFF, 0xFF, 0xFF, 0xFF},
+    {0xFF, 0xFF, 0xFF, 0xFF},
+    {0xFF, 0xFF, 0xFF, 0xFF},
+};
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 #define GRID_DIMENS MIN(WINDOW_WIDTH, WINDOW_HEIGHT)
 #define GRID_X0 (WINDOW_WIDTH / 2 - GRID_DIMENS / 2)
 #define GRID_Y0 (WINDOW_HEIGHT / 2 - GRID_DIMENS / 2)
+#define CELL_DIMENS (GRID_DIMENS / GRID_SIZE)
 
 #define return_defer(x) do {ret = x; goto defer;} while(0)
 
-struct Pos {
-    int x;
-    int y;
-};
-
-enum Direction {
-    DOWN,
-    LEFT,
-    RIGHT,
-    UP
-};
-
 void printSdlError(char* message) {
     fprintf(stderr, "Error ");
     fprintf(stderr, "%s", message);
     fprintf(stderr, ": %s\n", SDL_GetError());
 }
 
-void errnoAbort(char* message) {
-    perror(message);
-    exit(-1);
-}
-
-// posix check error
-int pcr(int ret, char* message) {
-    if (ret < 0) errnoAbort(message);
-
-    return ret;
-}
-
-// posix check pointer
-void* pcp(void* p, char* message) {
-    if (!p) errnoAbort(message);
-
-    return p;
-}
-
-bool init() {
+bool init(bool vsync) {
     bool ret = true;
 
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) return_defer(false);
@@ -113,9 +79,14 @@ bool init() {
     );
     if (!window) return_defer(false);
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+    if (vsync) renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+
+    renderer = SDL_CreateRenderer(window, -1, renderer_flags);
     if (!renderer) return_defer(false);
 
+    spriteBatchInit(&board_batch, renderer);
+
 defer:
     if (!ret) printSdlError("init");
     return ret;
@@ -127,142 +98,21 @@ bool loadMedia() {
     font = TTF_OpenFont("COMIC.TTF", 24);
     if (!font) return_defer(false);
 
-    SDL_Surface* head_surf = IMG_Load("head.png");
-    if (!head_surf) return_defer(false);
+    small_font = TTF_OpenFont("COMIC.TTF", 12);
+    if (!small_font) return_defer(false);
 
-    head_text = SDL_CreateTextureFromSurface(renderer, head_surf);
-    SDL_FreeSurface(head_surf);
+    if (!glyphAtlasInit(&font_atlas, renderer, font)) return_defer(false);
+    if (!glyphAtlasInit(&small_font_atlas, renderer, small_font)) return_defer(false);
 
-    if (!head_text) return_defer(false);
-
-    SDL_Surface* body_surf = IMG_Load("body.png");
-    if (!body_surf) return_defer(false);
-
-    body_text = SDL_CreateTextureFromSurface(renderer, body_surf);
-    SDL_FreeSurface(body_surf);
-
-    if (!body_text) return_defer(false);
+    if (!spriteAtlasInit(&sprite_atlas, renderer, "head.png", "body.png", CELL_DIMENS, player_tints)) {
+        return_defer(false);
+    }
 
 defer:
     if (!ret) printSdlError("load media");
     return ret;
 }
 
-#define POWERUP_SIZE 3
-
-enum Powerup {
-    NONE,
-    ZOMBIE,
-    SONIC,
-};
-
-struct Apple {
-    struct Pos pos;
-    enum Powerup type;
-};
-
-void appleInit(struct Apple* p_apple) {
-    p_apple->pos.x = rand() % GRID_SIZE;
-    p_apple->pos.y = rand() % GRID_SIZE;
-
-    int odds[POWERUP_SIZE];
-    odds[NONE] = 10;
-    odds[ZOMBIE] = 1;
-    odds[SONIC] = 1;
-
-    int total = 0;
-    for (size_t i = 0; i < POWERUP_SIZE; i++) {
-        total += odds[i];
-    }
-
-    int r = rand() % total;
-
-    int accum = 0;
-    for (size_t i = 0; i < POWERUP_SIZE; i++) {
-        if (r < odds[i] + accum) {
-            p_apple->type = (enum Powerup)i;
-            break;
-        }
-        accum += odds[i];
-    }
-}
-
-struct AppleSpawner {
-    struct Apple apples[APPLES_SIZE];
-    size_t apples_size;
-
-    uint32_t last_spawn_frame;
-    uint32_t spawn_delay;
-};
-
-void appleSpawnerInit(struct AppleSpawner* p_apple_spawner) {
-    for (size_t i = 0; i < p_apple_spawner->apples_size; i++) {
-        appleInit(&p_apple_spawner->apples[i]);
-    }
-    p_apple_spawner->apples_size = 1;
-    p_apple_spawner->last_spawn_frame = 0;
-    p_apple_spawner->spawn_delay = 3000;
-}
-
-struct Player {
-    int score;
-    bool game_over;
-
-    uint32_t last_movem_frame;
-    uint32_t movem_delay;
-
-    struct Pos pos;
-    struct Pos body[BODY_SIZE];
-    size_t body_size;
-
-    enum Direction direc;
-    enum Direction direc_buff[DIREC_BUFFER_SIZE];
-    int direc_size;
-    int direc_i;
-    bool reset_buffer_on_input;
-
-    uint32_t zombie_end;
-    uint32_t zombie_duration;
-
-    uint32_t sonic_end;
-    uint32_t sonic_duration;
-
-    SDL_Keycode bindings[4];
-};
-
-void playerInit(struct Player* p_player) {
-    p_player->score = 0;
-    p_player->game_over = false;
-
-    p_player->last_movem_frame = 0;
-    p_player->movem_delay = 250;
-
-    p_player->pos.x = 0;
-    p_player->pos.y = 0;
-
-    p_player->body_size = 0;
-
-    p_player->direc = RIGHT;
-    p_player->direc_size = 0;
-    p_player->direc_i = 0;
-    p_player->reset_buffer_on_input = true;
-
-    p_player->zombie_end = 0;
-    p_player->zombie_duration = 3000;
-
-    p_player->sonic_end = 0;
-    p_player->sonic_duration = 3000;
-}
-
-struct GameState {
-    struct AppleSpawner apple_spawner;
-    struct Player players[MAX_PLAYERS_SIZE];
-    size_t players_size;
-
-    struct Pos dead_bodies[DEAD_BODIES_SIZE];
-    size_t dead_bodies_size;
-};
-
 bool mapKeycode(SDL_Keycode* bindings, SDL_Keycode keycode, enum Direction* direc) {
     for (size_t i = 0; i < 4; i++) {
         if (bindings[i] == keycode) {
@@ -274,181 +124,24 @@ bool mapKeycode(SDL_Keycode* bindings, SDL_Keycode keycode, enum Direction* dire
     return false;
 }
 
-void addDirection(struct Player* player, enum Direction direc) {
-    if (player->reset_buffer_on_input) {
-        player->reset_buffer_on_input = false;
-        player->direc_size = 0;
-        player->direc_i = 0;
-    }
-    if (player->direc_size < DIREC_BUFFER_SIZE) {
-        player->direc_buff[player->direc_size++] = direc;
-    }
+// For text that changes from frame to frame, hitbox sized with glyphAtlasSize
+void renderText(struct GlyphAtlas* atlas, char* msg, SDL_Rect* hitbox, SDL_Color color) {
+    glyphAtlasDraw(atlas, renderer, msg, hitbox->x, hitbox->y, color);
 }
 
-/*
- * All players must move their heads and bodies before checking collision
- * */
-void gameStateUpdate(struct GameState* game_state, uint32_t curr_time) {
-    // Initialize to false
-    bool move[MAX_PLAYERS_SIZE] = {0};
-
-    // Check if player will move
-    for (size_t i = 0; i < game_state->players_size; i++) {
-        if (game_state->players[i].game_over) {
-            continue;
-        }
-
-        uint32_t movem_delay = game_state->players[i].movem_delay;
-        if (curr_time < game_state->players[i].sonic_end) {
-            movem_delay /= 2;
-        }
-
-        if (curr_time - game_state->players[i].last_movem_frame > movem_delay) {
-            move[i] = true;
-        }
-    }
-
-    // Move heads
-    struct Pos last_pos[MAX_PLAYERS_SIZE];
-    for (size_t i = 0; i < game_state->players_size; i++) {
-        if (game_state->players[i].game_over || !move[i]) continue;
-
-        game_state->players[i].last_movem_frame = curr_time;
-        game_state->players[i].reset_buffer_on_input = true;
-
-        // Store last position
-        last_pos[i] = game_state->players[i].pos;
-
-        // Check input in buffer
-        if (game_state->players[i].direc_i < game_state->players[i].direc_size) {
-            game_state->players[i].direc = game_state->players[i].direc_buff[game_state->players[i].direc_i++];
-        }
-
-        // Move
-        switch (game_state->players[i].direc) {
-        case DOWN: {
-            game_state->players[i].pos.y++;
-        } break;
-        case LEFT: {
-            game_state->players[i].pos.x--;
-        } break;
-        case RIGHT: {
-            game_state->players[i].pos.x++;
-        } break;
-        case UP: {
-            game_state->players[i].pos.y--;
-        } break;
-        }
-
-        // Wraparound
-        if (game_state->players[i].pos.x < 0) {
-            game_state->players[i].pos.x = GRID_SIZE-1;
-        } else if (game_state->players[i].pos.x >= GRID_SIZE) {
-            game_state->players[i].pos.x = 0;
-        }
-
-        if (game_state->players[i].pos.y < 0) {
-            game_state->players[i].pos.y = GRID_SIZE-1;
-        } else if (game_state->players[i].pos.y >= GRID_SIZE) {
-            game_state->players[i].pos.y = 0;
-        }
-    }
-
-    // Check apples
-    for (size_t p_i = 0; p_i < game_state->players_size; p_i++) {
-        if (game_state->players[p_i].game_over) continue;
-
-        for (size_t a_i = 0; a_i < game_state->apple_spawner.apples_size; a_i++) {
-            if (game_state->players[p_i].pos.x == game_state->apple_spawner.apples[a_i].pos.x
-                    && game_state->players[p_i].pos.y == game_state->apple_spawner.apples[a_i].pos.y) {
-                game_state->players[p_i].score++;
-
-                switch (game_state->apple_spawner.apples[a_i].type) {
-                case NONE: {
-                } break;
-                case ZOMBIE: {
-                    game_state->players[p_i].zombie_end = curr_time + game_state->players[p_i].zombie_duration;
-                } break;
-                case SONIC: {
-                    game_state->players[p_i].sonic_end = curr_time + game_state->players[p_i].sonic_duration;
-                } break;
-                }
-
-                appleInit(&game_state->apple_spawner.apples[a_i]);
-
-                game_state->players[p_i].body_size++;
-            }
-        }
-    }
-
-    // Move body and zombie
-    for (size_t p_i = 0; p_i < game_state->players_size; p_i++) {
-        if (game_state->players[p_i].game_over || !move[p_i]) continue;
-
-        // Move body
-        if (game_state->players[p_i].body_size > 0) {
-            for (size_t b_i = game_state->players[p_i].body_size-1; b_i > 0; b_i--) {
-                game_state->players[p_i].body[b_i] = game_state->players[p_i].body[b_i-1];
-            }
-            game_state->players[p_i].body[0] = last_pos[p_i];
-        }
-
-        // Add zombie dead body
-        if (curr_time < game_state->players[p_i].zombie_end) {
-            if (game_state->players[p_i].body_size > 0) {
-                game_state->dead_bodies[game_state->dead_bodies_size] = game_state->players[p_i].body[game_state->players[p_i].body_size-1];
-
-                game_state->dead_bodies_size++;
-                game_state->players[p_i].body_size--;
-            }
-        }
-    }
-
-    // Check colision
-    for (size_t this_i = 0; this_i < game_state->players_size; this_i++) {
-        if (game_state->players[this_i].game_over) continue;
-
-        for (size_t other_i = 0; other_i < game_state->players_size; other_i++) {
-            if (this_i != other_i
-                    && game_state->players[this_i].pos.x == game_state->players[other_i].pos.x
-                    && game_state->players[this_i].pos.y == game_state->players[other_i].pos.y) {
-                game_state->players[this_i].game_over = true;
-            }
-
-            for (size_t k = 0; k < game_state->players[other_i].body_size; k++) {
-                struct Pos* p_body = &game_state->players[other_i].body[k];
-
-                if (game_state->players[this_i].pos.x == p_body->x && game_state->players[this_i].pos.y == p_body->y) {
-                    game_state->players[this_i].game_over = true;
-                }
-            }
-        }
-
-        for (size_t d_i = 0; d_i < game_state->dead_bodies_size; d_i++) {
-            if (game_state->players[this_i].pos.x == game_state->dead_bodies[d_i].x
-                && game_state->players[this_i].pos.y == game_state->dead_bodies[d_i].y) {
-                game_state->players[this_i].game_over = true;
-            }
-        }
-    }
-
-    // Spawn apples
-    if (curr_time - game_state->apple_spawner.last_spawn_frame > game_state->apple_spawner.spawn_delay) {
-        game_state->apple_spawner.last_spawn_frame = curr_time;
-        appleInit(&game_state->apple_spawner.apples[game_state->apple_spawner.apples_size++]);
+// For text that stays the same, hitbox sized with TTF_SizeText. It's only
+// rasterized the first time.
+void renderStaticText(struct GlyphAtlas* atlas, char* msg, SDL_Rect* hitbox, SDL_Color color) {
+    struct CachedText* cached = textCacheGet(&text_cache, renderer, atlas, msg, color);
+    if (cached) {
+        SDL_RenderCopy(renderer, cached->texture, NULL, hitbox);
+    } else {
+        renderText(atlas, msg, hitbox, color);
     }
 }
 
 void renderMsg(char* msg, SDL_Rect* hitbox, SDL_Color color) {
-    SDL_Color font_color = color;
-
-    SDL_Surface* surf = TTF_RenderText_Solid(font, msg, font_color);
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surf);
-    SDL_FreeSurface(surf);
-
-    SDL_RenderCopy(renderer, texture, NULL, hitbox);
-
-    SDL_DestroyTexture(texture);
+    renderStaticText(&font_atlas, msg, hitbox, color);
 }
 
 void renderMsgsCentered(char** texts, size_t button_qty, SDL_Rect* hitbox, SDL_Color* colors) {
@@ -477,43 +170,177 @@ void renderMsgsCentered(char** texts, size_t button_qty, SDL_Rect* hitbox, SDL_C
     }
 }
 
-SDL_Rect posToRect(struct Pos* p_pos) {
+/*
+ * What's drawn in a board cell, a bit per layer from the bottom one up, with
+ * the apple's type and the head's direction. A cell is only drawn again when
+ * this changes.
+ * */
+#define CELL_APPLE 0x01
+#define CELL_APPLE_TYPE_SHIFT 1
+#define CELL_APPLE_TYPE_MASK (0x3 << CELL_APPLE_TYPE_SHIFT)
+#define CELL_DEAD 0x08
+#define CELL_BODY 0x10
+#define CELL_HEAD 0x20
+#define CELL_HEAD_DIREC_SHIFT 6
+#define CELL_HEAD_DIREC_MASK (0x3 << CELL_HEAD_DIREC_SHIFT)
+// Whose body and head they are, for their sprites
+#define CELL_BODY_PLAYER_SHIFT 8
+#define CELL_BODY_PLAYER_MASK (0x3 << CELL_BODY_PLAYER_SHIFT)
+#define CELL_HEAD_PLAYER_SHIFT 10
+#define CELL_HEAD_PLAYER_MASK (0x3 << CELL_HEAD_PLAYER_SHIFT)
+
+/*
+ * The board is drawn into a texture kept from frame to frame, so only the
+ * cells that changed since the last one are drawn again, usually a head,
+ * the cell behind it and a tail per snake. The background around it never
+ * changes and is drawn once. Without render targets, everything is drawn
+ * every frame instead.
+ * */
+struct BoardCache {
+    SDL_Texture* background;
+    SDL_Texture* board;
+    uint32_t cells[GRID_SIZE][GRID_SIZE];
+    // False until the textures are drawn whole, and again when the renderer
+    // loses them
+    bool valid;
+} board_cache;
+
+bool posInGrid(struct Pos* pos) {
+    return pos->x >= 0 && pos->x < GRID_SIZE && pos->y >= 0 && pos->y < GRID_SIZE;
+}
+
+// Later layers cover the earlier ones, and the last apple or head in a cell
+// is the one on top
+void boardCells(struct GameState* game_state, uint32_t cells[GRID_SIZE][GRID_SIZE]) {
+    memset(cells, 0, sizeof(uint32_t)*GRID_SIZE*GRID_SIZE);
+
+    for (size_t i = 0; i < game_state->apple_spawner.apples_size; i++) {
+        struct Apple* apple = &game_state->apple_spawner.apples[i];
+        if (!posInGrid(&apple->pos)) continue;
+
+        uint32_t* cell = &cells[apple->pos.y][apple->pos.x];
+        *cell = (*cell & ~CELL_APPLE_TYPE_MASK) | CELL_APPLE | apple->type << CELL_APPLE_TYPE_SHIFT;
+    }
+
+    for (size_t i = 0; i < game_state->dead_bodies_size; i++) {
+        struct Pos* pos = &game_state->dead_bodies[i];
+        if (posInGrid(pos)) cells[pos->y][pos->x] |= CELL_DEAD;
+    }
+
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        struct Player* player = &game_state->players[i];
+        for (size_t j = 0; j < player->body_size; j++) {
+            struct Pos* pos = &player->body[j];
+            if (!posInGrid(pos)) continue;
+
+            uint32_t* cell = &cells[pos->y][pos->x];
+            *cell = (*cell & ~CELL_BODY_PLAYER_MASK) | CELL_BODY | i << CELL_BODY_PLAYER_SHIFT;
+        }
+    }
+
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        struct Player* player = &game_state->players[i];
+        if (!posInGrid(&player->pos)) continue;
+
+        uint32_t* cell = &cells[player->pos.y][player->pos.x];
+        *cell = (*cell & ~(CELL_HEAD_DIREC_MASK | CELL_HEAD_PLAYER_MASK)) | CELL_HEAD
+            | player->direc << CELL_HEAD_DIREC_SHIFT | i << CELL_HEAD_PLAYER_SHIFT;
+    }
+}
+
+SDL_Rect cellRect(struct Pos* pos, int x0, int y0) {
     SDL_Rect rect;
-    rect.x = GRID_X0 + p_pos->x * GRID_DIMENS / GRID_SIZE;
-    rect.y = GRID_Y0 + p_pos->y * GRID_DIMENS / GRID_SIZE;
-    rect.w = GRID_DIMENS / GRID_SIZE;
-    rect.h = GRID_DIMENS / GRID_SIZE;
+    rect.x = x0 + pos->x * GRID_DIMENS / GRID_SIZE;
+    rect.y = y0 + pos->y * GRID_DIMENS / GRID_SIZE;
+    rect.w = CELL_DIMENS;
+    rect.h = CELL_DIMENS;
 
     return rect;
 }
 
-void playerRenderBody(struct Player* p_player) {
-    for (size_t i = 0; i < p_player->body_size; i++) {
-        SDL_Rect body_rect = posToRect(&p_player->body[i]);
-        SDL_RenderCopy(renderer, body_text, NULL, &body_rect);
+/*
+ * Each cell at pos drawn whole over what was there, with the grid at
+ * (x0, y0). Fills and sprites all come from the sprite atlas, so it's one
+ * draw call however many cells there are.
+ * */
+void drawCells(uint32_t cells[GRID_SIZE][GRID_SIZE], struct Pos* pos, size_t pos_size, int x0, int y0) {
+    SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+    SDL_Color grid_color = {0x18, 0x18, 0x18, 0xFF};
+    SDL_Color dead_color = {0x02, 0x30, 0x20, 0xFF};
+    SDL_Texture* texture = sprite_atlas.texture;
+    SDL_Rect* fill = &sprite_atlas.sprites[0][SPRITE_WHITE];
+
+    for (size_t i = 0; i < pos_size; i++) {
+        uint32_t cell = cells[pos[i].y][pos[i].x];
+        SDL_Rect rect = cellRect(&pos[i], x0, y0);
+
+        spriteBatchCopy(&board_batch, texture, fill, &rect, grid_color);
+
+        if (cell & CELL_APPLE) {
+            SDL_Color color;
+            switch ((enum Powerup)((cell & CELL_APPLE_TYPE_MASK) >> CELL_APPLE_TYPE_SHIFT)) {
+            case NONE: {
+                color = (SDL_Color){0xFF, 0, 0, 255};
+            } break;
+            case ZOMBIE: {
+                color = (SDL_Color){0x00, 0xFF, 0, 255};
+            } break;
+            case SONIC: {
+                color = (SDL_Color){0x00, 0x00, 0xFF, 255};
+            } break;
+            }
+            spriteBatchCopy(&board_batch, texture, fill, &rect, color);
+        }
+
+        if (cell & CELL_DEAD) {
+            spriteBatchCopy(&board_batch, texture, fill, &rect, dead_color);
+        }
+
+        if (cell & CELL_BODY) {
+            size_t player_i = (cell & CELL_BODY_PLAYER_MASK) >> CELL_BODY_PLAYER_SHIFT;
+            spriteBatchCopy(&board_batch, texture, &sprite_atlas.sprites[player_i][SPRITE_BODY], &rect, white);
+        }
+
+        if (cell & CELL_HEAD) {
+            size_t player_i = (cell & CELL_HEAD_PLAYER_MASK) >> CELL_HEAD_PLAYER_SHIFT;
+            enum Direction direc = (cell & CELL_HEAD_DIREC_MASK) >> CELL_HEAD_DIREC_SHIFT;
+            spriteBatchCopy(&board_batch, texture, &sprite_atlas.sprites[player_i][SPRITE_HEAD + direc], &rect, white);
+        }
     }
-}
 
-void playerRenderHead(struct Player* p_player) {
-    SDL_Rect head_rect = posToRect(&p_player->pos);
+    spriteBatchFlush(&board_batch);
+}
 
-    double rotation;
-    switch (p_player->direc) {
-    case DOWN: {
-        rotation = 180;
-    } break;
-    case RIGHT: {
-        rotation = 90;
-    } break;
-    case LEFT: {
-        rotation = 270;
-    } break;
-    case UP: {
-        rotation = 0;
-    } break;
+// Both stay NULL without render targets
+void boardCacheInit() {
+    if (!SDL_RenderTargetSupported(renderer)) return;
+
+    board_cache.background = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
+    board_cache.board = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, GRID_DIMENS, GRID_DIMENS);
+    if (!board_cache.background || !board_cache.board) {
+        if (board_cache.background) SDL_DestroyTexture(board_cache.background);
+        if (board_cache.board) SDL_DestroyTexture(board_cache.board);
+        board_cache.background = NULL;
+        board_cache.board = NULL;
     }
+    board_cache.valid = false;
+}
+
+void boardCacheFree() {
+    if (board_cache.background) SDL_DestroyTexture(board_cache.background);
+    if (board_cache.board) SDL_DestroyTexture(board_cache.board);
+    board_cache.background = NULL;
+    board_cache.board = NULL;
+}
 
-    SDL_RenderCopyEx(renderer, head_text, NULL, &head_rect, rotation, NULL, 0);
+void renderBackground() {
+    SDL_SetRenderDrawColor(renderer, 0x3C, 0xDF, 0xFF, 255);
+    SDL_RenderClear(renderer);
+
+    // Grid
+    SDL_SetRenderDrawColor(renderer, 0x18, 0x18, 0x18, 255);
+    SDL_Rect grid_rect = {.x = GRID_X0, .y = GRID_Y0, .w = GRID_DIMENS, .h = GRID_DIMENS};
+    SDL_RenderFillRect(renderer, &grid_rect);
 }
 
 void renderPlayersScore(struct Player* players, size_t players_size) {
@@ -530,11 +357,11 @@ void renderPlayersScore(struct Player* players, size_t players_size) {
         SDL_Color score_color = {0x56, 0x73, 0x45, 255};
 
         SDL_Rect score_rect;
-        TTF_SizeText(font, message, &score_rect.w, &score_rect.h);
+        glyphAtlasSize(&font_atlas, message, &score_rect.w, &score_rect.h);
         score_rect.x = 0;
         score_rect.y = y;
 
-        renderMsg(message, &score_rect, score_color);
+        renderText(&font_atlas, message, &score_rect, score_color);
 
         y += score_rect.h;
     }
@@ -550,40 +377,13 @@ enum Mode {
 enum MenuMode {
     MN_CHOOSE_NETWORK,
     MN_HOST_OR_JOIN,
+    MN_ADDRESS,
     MN_LOBBY,
     MN_REMAP_MENU,
     MN_OPTIONS_MENU,
     MN_MAIN_MENU
 };
 
-void reset(struct GameState* game_state) {
-    appleSpawnerInit(&game_state->apple_spawner);
-    for (size_t i = 0; i < MAX_PLAYERS_SIZE; i++) {
-        playerInit(&game_state->players[i]);
-    }
-
-    struct Pos init_pos[MAX_PLAYERS_SIZE] = {
-        {0, 0},
-        {GRID_SIZE-1, 0},
-        {0, GRID_SIZE-1},
-        {GRID_SIZE-1, GRID_SIZE-1}
-    };
-
-    enum Direction init_direc[MAX_PLAYERS_SIZE] = {
-        RIGHT,
-        LEFT,
-        RIGHT,
-        LEFT
-    };
-
-    for (size_t i = 0; i < MAX_PLAYERS_SIZE; i++) {
-        game_state->players[i].pos = init_pos[i];
-        game_state->players[i].direc = init_direc[i];
-    }
-
-    game_state->dead_bodies_size = 0;
-}
-
 
 bool rectContainsPos(SDL_Rect* rect, struct Pos* pos) {
     return pos->x > rect->x
@@ -598,119 +398,53 @@ void clearScreen() {
 }
 
 void render(struct GameState* game_state) {
-    // Background
-    SDL_SetRenderDrawColor(renderer, 0x3C, 0xDF, 0xFF, 255);
-    SDL_RenderClear(renderer);
+    uint32_t cells[GRID_SIZE][GRID_SIZE];
+    boardCells(game_state, cells);
 
-    // Grid
-    SDL_SetRenderDrawColor(renderer, 0x18, 0x18, 0x18, 255);
-    SDL_Rect grid_rect = {.x = GRID_X0, .y = GRID_Y0, .w = GRID_DIMENS, .h = GRID_DIMENS};
-    SDL_RenderFillRect(renderer, &grid_rect);
+    struct Pos pos[GRID_SIZE*GRID_SIZE];
+    size_t pos_size = 0;
 
-    // Apple
-    SDL_SetRenderDrawColor(renderer, 0xFF, 0, 0, 255);
-    for (size_t i = 0; i < game_state->apple_spawner.apples_size; i++) {
-        switch (game_state->apple_spawner.apples[i].type) {
-        case NONE: {
-            SDL_SetRenderDrawColor(renderer, 0xFF, 0, 0, 255);
-        } break;
-        case ZOMBIE: {
-            SDL_SetRenderDrawColor(renderer, 0x00, 0xFF, 0, 255);
-        } break;
-        case SONIC: {
-            SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0xFF, 255);
-        } break;
+    if (!board_cache.board) {
+        renderBackground();
+
+        for (int y = 0; y < GRID_SIZE; y++) {
+            for (int x = 0; x < GRID_SIZE; x++) {
+                if (cells[y][x]) pos[pos_size++] = (struct Pos){x, y};
+            }
+        }
+        drawCells(cells, pos, pos_size, GRID_X0, GRID_Y0);
+    } else {
+        if (!board_cache.valid) {
+            SDL_SetRenderTarget(renderer, board_cache.background);
+            renderBackground();
         }
 
-        SDL_Rect apple_rect = posToRect(&game_state->apple_spawner.apples[i].pos);
-        SDL_RenderFillRect(renderer, &apple_rect);
-    }
+        for (int y = 0; y < GRID_SIZE; y++) {
+            for (int x = 0; x < GRID_SIZE; x++) {
+                if (!board_cache.valid || cells[y][x] != board_cache.cells[y][x]) {
+                    pos[pos_size++] = (struct Pos){x, y};
+                }
+            }
+        }
 
-    // Dead bodies
-    for (size_t i = 0; i < game_state->dead_bodies_size; i++) {
-        SDL_SetRenderDrawColor(renderer, 0x02, 0x30, 0x20, 0xFF);
-        SDL_Rect rect = posToRect(&game_state->dead_bodies[i]);
-        SDL_RenderFillRect(renderer, &rect);
-    }
+        if (pos_size > 0) {
+            SDL_SetRenderTarget(renderer, board_cache.board);
+            drawCells(cells, pos, pos_size, 0, 0);
+        }
+        SDL_SetRenderTarget(renderer, NULL);
 
-    // Body
-    for (size_t i = 0; i < game_state->players_size; i++) {
-        playerRenderBody(&game_state->players[i]);
-    }
+        memcpy(board_cache.cells, cells, sizeof(cells));
+        board_cache.valid = true;
 
-    // Snake Head
-    for (size_t i = 0; i < game_state->players_size; i++) {
-        playerRenderHead(&game_state->players[i]);
+        SDL_Rect grid_rect = {.x = GRID_X0, .y = GRID_Y0, .w = GRID_DIMENS, .h = GRID_DIMENS};
+        SDL_RenderCopy(renderer, board_cache.background, NULL, NULL);
+        SDL_RenderCopy(renderer, board_cache.board, NULL, &grid_rect);
     }
 
     // Score
     renderPlayersScore(game_state->players, game_state->players_size);
 }
 
-bool readBytes(int fd, void* data, size_t data_size, bool wait) {
-    assert(data_size != 0);
-
-    while (true) {
-        ssize_t bytes = recv(fd, data, data_size, MSG_PEEK);
-        assert(bytes <= (ssize_t)data_size);
-
-        #ifdef __linux__
-        if ((bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
-            || (0 < bytes && bytes < (ssize_t)data_size)) {
-            if (wait) continue;
-            else return false;
-        }
-        pcr(bytes, "read failed");
-        #elif defined(WINDOWS)
-        int error = WSAGetLastError();
-        if ((bytes < 0 && error == WSAEWOULDBLOCK)
-        || (0 < bytes && bytes < data_size)) {
-            if (wait) continue;
-            else return false;
-        } else if (bytes < 0) {
-            fprintf(stderr, "read failed: %d\n", error);
-            exit(EXIT_FAILURE);
-        }
-        #endif // defined
-
-        if (bytes == 0) {
-            fprintf(stderr, "Disconnected\n");
-            exit(EXIT_FAILURE);
-        }
-
-        recv(fd, data, data_size, 0);
-        return true;
-    }
-}
-
-void writeBytes(int fd, void* data, size_t data_size) {
-    size_t bytes_sent = 0;
-    while (bytes_sent < data_size) {
-#ifdef __linux__
-        int ret = send(fd, (void*)((uint8_t*)data+bytes_sent), data_size-bytes_sent, MSG_NOSIGNAL);
-
-        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            continue;
-        }
-        pcr(ret, "Write error");
-#elif defined(WINDOWS)
-        int ret = send(fd, (void*)((uint8_t*)data+bytes_sent), data_size-bytes_sent, 0);
-
-        if (ret < 0) {
-            int error = WSAGetLastError();
-            if (error == WSAEWOULDBLOCK) {
-                continue;
-            } else {
-                fprintf(stderr, "send failed: %d\n", error);
-                exit(EXIT_FAILURE);
-            }
-        }
-#endif // defined
-
-        bytes_sent += ret;
-    }
-}
-
 struct Input {
     struct Pos mouse_pos;
     bool is_mouse_clicked;
@@ -718,6 +452,10 @@ struct Input {
     SDL_Keycode key_pressed;
     bool letters_pressed[26];
     bool arrows_pressed[4];
+
+    // Typed this frame
+    char text[32];
+    size_t text_size;
 };
 
 bool validKey(SDL_Keycode key) {
@@ -747,6 +485,18 @@ bool getInput(struct Input* input) {
             input->is_key_pressed = true;
             input->key_pressed = key;
         } break;
+        case SDL_RENDER_TARGETS_RESET:
+        case SDL_RENDER_DEVICE_RESET: {
+            // What was drawn into the board's textures is gone
+            board_cache.valid = false;
+        } break;
+        case SDL_TEXTINPUT: {
+            size_t len = strlen(event.text.text);
+            if (input->text_size + len < sizeof(input->text)) {
+                memcpy(&input->text[input->text_size], event.text.text, len + 1);
+                input->text_size += len;
+            }
+        } break;
         }
     }
 
@@ -772,115 +522,503 @@ struct GameOver {
     .delay = 1000,
 };
 
-struct Lobby {
-    uint16_t delay;
-    uint16_t start;
-} lobby = {
-    .delay = 100,
-    .start = 0
-};
+struct Menu {
+    SDL_Color button_color;
+} menu = {
+    .button_color = {0xFF, 0x00, 0x00, 0xFF},
+};
+
+struct RemapMenu {
+    SDL_Color button_sel_color;
+    bool button_sel;
+    size_t button_sel_i;
+    size_t sel_player_i;
+} remap_menu = {
+    .button_sel_color = {0x00, 0xFF, 0x00, 0xFF},
+    .button_sel = false,
+    .sel_player_i = 0,
+};
+
+// Local only, so they stay out of the state sent online
+SDL_Keycode bindings[MAX_PLAYERS_SIZE][4] = {
+    {SDLK_s, SDLK_a, SDLK_d, SDLK_w},
+    {SDLK_DOWN, SDLK_LEFT, SDLK_RIGHT, SDLK_UP},
+    {SDLK_g, SDLK_f, SDLK_h, SDLK_t},
+    {SDLK_k, SDLK_j, SDLK_l, SDLK_i}
+};
+
+enum NetworkRole {
+    NET_HOST,
+    NET_JOIN,
+    NET_SPECTATE,
+};
+
+#define ADDRESS_SIZE 32
+// Connecting to the host takes longer than this only if it's unreachable
+#define CONNECT_TIMEOUT 5000
+
+struct Network {
+    struct sockaddr_in host_addr;
+    enum NetworkRole role;
+
+    // "IP:PORT" or "PORT", edited in MN_ADDRESS
+    char address[ADDRESS_SIZE];
+    // Shown in MN_ADDRESS after a failed attempt
+    char error[64];
+
+    // Has all the sockets, started by the first networkStart
+    struct NetThread* thread;
+} network = {
+    .address = "127.0.0.1:5000",
+};
+
+/*
+ * Everything the menus ask for can also be given on the command line or in
+ * a config file, so a match can be started without touching the window.
+ * */
+struct Options {
+    bool autostart;
+    enum NetworkRole role;
+    size_t players_size;
+    bool has_seed;
+    unsigned seed;
+    // Ticks, when hosting
+    int input_delay;
+    enum FrameMode frame_mode;
+    int frame_rate;
+} options = {
+    .players_size = 1,
+    .input_delay = INPUT_DELAY_AUTO,
+    .frame_mode = FRAME_CAPPED,
+    .frame_rate = DEFAULT_FRAME_RATE,
+};
+
+struct NetworkHost {
+    // Player 0 is the host itself
+    struct Room room;
+    struct TickTimes tick_times;
+} host;
+
+struct NetworkClient {
+    struct Conn conn;
+    bool is_spectator;
+    size_t player_i;
+    struct InputHistory inputs;
+    // Inputs are scheduled for input_delay ticks after the one the host is on
+    // when they're pressed
+    struct MatchClock match_clock;
+    uint32_t input_delay;
+
+    struct TickStats host_ticks;
+    bool has_host_ticks;
+
+    uint8_t token[SESSION_TOKEN_SIZE];
+    // Reconnecting since lost_at
+    bool lost;
+    uint32_t lost_at;
+    uint32_t last_attempt;
+    // Waiting on the net thread for the first connection to the host, or
+    // for an attempt to reconnect
+    bool connecting;
+    // Reconnecting took longer than RESUME_GRACE, left to the main thread
+    // to go back to the menu
+    bool gave_up;
+} client;
+
+bool is_online = false;
+bool is_host = false;
+// F3 while playing online
+bool show_net_stats = true;
+struct FramePacer frame_pacer;
+
+// Each thread's own, the simulation thread keeps the match's
+_Thread_local uint32_t curr_time;
+
+struct Input input;
+
+// Lines of the net stats overlay, more wouldn't fit the window
+#define NET_STATS_LINES 32
+#define NET_STATS_LINE_SIZE 160
+// Key presses waiting for the simulation's next tick, a power of two
+#define SIM_KEYS_SIZE 64
+
+// What the window needs to draw a tick
+struct Snapshot {
+    struct GameState game_state;
+    // Every player died, the match is over
+    bool game_over;
+    bool lost;
+    // Reconnecting gave up, the simulation stopped with it
+    bool host_lost;
+
+    // From the bottom up
+    char net_stats[NET_STATS_LINES][NET_STATS_LINE_SIZE];
+    size_t net_stats_size;
+};
+
+/*
+ * During a match, the simulation and the sockets run on a thread of their
+ * own, a tick every DEFAULT_TICK_TIME like the dedicated server's, while the
+ * main thread keeps the window. SDL wants the window's events and renderer
+ * on the thread that made them, so it's the simulation that moves.
+ *
+ * The main thread hands over key presses through a ring, and draws the
+ * newest snapshot the simulation published through a triple buffer, so
+ * neither waits on the other and frames and ticks go at their own rates.
+ * game_state, host, client and network are only the simulation's until
+ * it's stopped.
+ * */
+struct SimThread {
+    SDL_Thread* thread;
+    uint32_t stop;
+
+    // Written by the simulation
+    _Alignas(64) uint32_t keys_head;
+    // Written by the main thread
+    _Alignas(64) uint32_t keys_tail;
+    SDL_Keycode keys[SIM_KEYS_SIZE];
+
+    struct TripleBuffer buffer;
+    struct Snapshot snapshots[3];
+} sim;
+
+// "IP:PORT", or just "PORT" for any address when hosting and this machine
+// when joining
+bool parseAddress(char* str, struct sockaddr_in* addr, bool any) {
+    char ip[INET_ADDRSTRLEN] = "";
+
+    char* port_str = strrchr(str, ':');
+    if (port_str) {
+        size_t ip_len = port_str - str;
+        if (ip_len == 0 || ip_len >= sizeof(ip)) return false;
+
+        memcpy(ip, str, ip_len);
+        ip[ip_len] = '\0';
+        port_str++;
+    } else {
+        port_str = str;
+    }
+
+    char* end;
+    long port = strtol(port_str, &end, 10);
+    if (*port_str == '\0' || *end != '\0' || port < 1024 || port > UINT16_MAX) return false;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+
+    if (ip[0] != '\0') {
+        return inet_pton(AF_INET, ip, &addr->sin_addr) == 1;
+    }
+    addr->sin_addr.s_addr = htonl(any ? INADDR_ANY : INADDR_LOOPBACK);
+    return true;
+}
+
+void networkError(char* message) {
+    snprintf(network.error, sizeof(network.error), "%s", message);
+    fprintf(stderr, "%s\n", message);
+}
+
+// Hosting is ready right away, joining goes on from the lobby until connected
+bool networkStart() {
+    network.error[0] = '\0';
+
+    if (!parseAddress(network.address, &network.host_addr, network.role == NET_HOST)) {
+        networkError("Invalid address, expected IP:PORT");
+        return false;
+    }
+
+    if (!network.thread) {
+        network.thread = netThreadStart();
+        if (!network.thread) {
+            networkError("Can't start the network thread");
+            return false;
+        }
+    }
+
+    if (network.role == NET_HOST) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            networkError("Socket creation failed");
+            return false;
+        }
+
+        if (bind(fd, (struct sockaddr*)&network.host_addr, sizeof(network.host_addr)) < 0
+                || listen(fd, MAX_PEERS_SIZE) < 0) {
+            char message[64];
+            snprintf(message, sizeof(message), "Can't host there: %s", strerror(errno));
+            networkError(message);
+            closeFd(fd);
+            return false;
+        }
+        unblock(fd);
+        netThreadListen(network.thread, fd);
+
+        is_host = true;
+        game_state.players_size = 1;
+        roomInit(&host.room, &game_state);
+        host.room.input_delay_config = options.input_delay;
+
+        printf("Listening\n");
+        return true;
+    }
+
+    is_host = false;
+    netThreadConnect(network.thread, &network.host_addr, CONNECT_TIMEOUT);
+    client.connecting = true;
+
+    return true;
+}
+
+// 1 once connected, with the net thread's event, 0 while still connecting
+// and -1 if it failed
+int clientConnectPoll(struct NetEvent* event) {
+    while (netThreadNext(network.thread, event)) {
+        switch (event->type) {
+        case NET_CONNECTED: return 1;
+        case NET_CONNECT_FAILED: return -1;
+        default: break;
+        }
+    }
+
+    return 0;
+}
+
+// Ticked from the lobby, back to the address on failure
+void clientConnect() {
+    struct NetEvent event;
+    int connected = clientConnectPoll(&event);
+    if (connected == 0) return;
+
+    client.connecting = false;
+
+    if (connected < 0) {
+        networkError("Connection failed");
+        menu_mode = MN_ADDRESS;
+        return;
+    }
+
+    connInit(&client.conn, event.fd);
+    netThreadAttach(network.thread, event.channel, &client.conn);
+    printf("Connected\n");
+
+    uint8_t role = network.role == NET_JOIN ? ROLE_PLAYER : ROLE_SPECTATOR;
+    connSend(&client.conn, MSG_JOIN, &role, sizeof(role));
+}
+
+// What the net thread accepted since the last frame
+void hostAccept() {
+    struct NetEvent event;
+    while (netThreadNext(network.thread, &event)) {
+        if (event.type != NET_ACCEPTED) continue;
+
+        struct Peer* peer = roomAccept(&host.room, event.fd, curr_time);
+        if (peer) {
+            netThreadAttach(network.thread, event.channel, &peer->conn);
+        } else {
+            // No room, not even to watch
+            netThreadDrop(network.thread, event.channel);
+        }
+    }
+}
+
+void hostRecv() {
+    struct Room* rooms[1] = {&host.room};
+
+    roomRecv(&host.room, curr_time);
+    roomsResume(rooms, 1, curr_time);
+}
 
-struct Menu {
-    SDL_Color button_color;
-} menu = {
-    .button_color = {0xFF, 0x00, 0x00, 0xFF},
-};
+// Lines stack up from the bottom left
+void renderStatsLine(char* line, int* y) {
+    SDL_Color color = {0xFF, 0xFF, 0xFF, 0xFF};
 
-struct RemapMenu {
-    SDL_Color button_sel_color;
-    bool button_sel;
-    size_t button_sel_i;
-    size_t sel_player_i;
-} remap_menu = {
-    .button_sel_color = {0x00, 0xFF, 0x00, 0xFF},
-    .button_sel = false,
-    .sel_player_i = 0,
-};
+    SDL_Rect rect;
+    glyphAtlasSize(&small_font_atlas, line, &rect.w, &rect.h);
+    *y -= rect.h;
+    rect.x = 0;
+    rect.y = *y;
 
-struct Network {
-    struct sockaddr_in host_addr;
-} network;
+    renderText(&small_font_atlas, line, &rect, color);
+}
 
-struct NetworkHost {
-    int fd[MAX_PLAYERS_SIZE];
-} host;
+// On the simulation thread, into lines for the main thread to render
+size_t formatNetStats(char lines[][NET_STATS_LINE_SIZE], size_t lines_size) {
+    char stats[128];
+    size_t size = 0;
+
+    if (!is_host) {
+        connStatsFormat(&client.conn, stats, sizeof(stats));
+        snprintf(lines[size++], NET_STATS_LINE_SIZE, "host %s input %"PRIu32"ms delay %"PRIu32" ticks",
+            stats, client.inputs.latency, client.input_delay);
+
+        struct ClockSync* clock = &client.conn.clock;
+        if (clock->synced) {
+            uint32_t host_now = connRemoteTime(&client.conn, curr_time);
+            snprintf(lines[size++], NET_STATS_LINE_SIZE, "clock %+"PRId32"ms +-%"PRIu32"ms skew %"PRId32"ppm state age %"PRIu32"ms",
+                clock->offset, clock->error, clock->skew_ppm, matchClockAge(&client.match_clock, host_now));
+        }
 
-struct NetworkClient {
-    int fd;
-    size_t player_i;
-} client;
+        if (client.has_host_ticks) {
+            snprintf(lines[size++], NET_STATS_LINE_SIZE, "host tick p50 %"PRIu32"us p99 %"PRIu32"us max %"PRIu32"us",
+                client.host_ticks.p50, client.host_ticks.p99, client.host_ticks.max);
+        }
+        return size;
+    }
 
-bool is_online = false;
-bool is_host = false;
+    // The last line is kept for the host's own
+    for (size_t i = 0; i < MAX_PEERS_SIZE && size + 1 < lines_size; i++) {
+        struct Peer* peer = host.room.peers[i];
+        if (!peer || !peer->conn.open || !roomPeerWelcomed(peer)) continue;
+
+        connStatsFormat(&peer->conn, stats, sizeof(stats));
+        if (peer->role == ROLE_PLAYER) {
+            snprintf(lines[size++], NET_STATS_LINE_SIZE, "P%zu %s delay %"PRIu32"ms late %"PRIu64,
+                peer->player_i + 1, stats, peer->input_stats.delay, peer->input_stats.late);
+        } else {
+            snprintf(lines[size++], NET_STATS_LINE_SIZE, "S%zu %s", i + 1, stats);
+        }
+    }
 
-uint32_t curr_time;
+    snprintf(lines[size++], NET_STATS_LINE_SIZE, "P1 input delay %"PRIu32" ticks, %"PRIu32"ms",
+        host.room.input_delay, host.room.local_input_stats.delay);
+    return size;
+}
 
-struct Input input;
+void renderNetStats(struct Snapshot* snapshot) {
+    char line[NET_STATS_LINE_SIZE];
+    int y = WINDOW_HEIGHT;
 
-void getAddrAndPort(struct in_addr* addr, uint16_t* port) {
-    // Get IP
-    // @todo get max(ipv4.len, ipv6.len)
-    while (true) {
-        printf("Enter the IP address: ");
-        char ip[INET_ADDRSTRLEN];
+    struct FrameStats* frame_stats = &frame_pacer.stats;
+    if (frame_stats->frames > 0) {
+        snprintf(line, sizeof(line), "%.1f fps frame %.2fms +-%.2fms max %.2fms",
+            frame_stats->fps, frame_stats->mean, frame_stats->stddev, frame_stats->max);
+        renderStatsLine(line, &y);
+    }
 
-        char format[6] = " %00s";
-        sprintf(format, " %%%ds", INET_ADDRSTRLEN-1);
+    for (size_t i = 0; i < snapshot->net_stats_size && y > 0; i++) {
+        renderStatsLine(snapshot->net_stats[i], &y);
+    }
+}
 
-        int result = scanf(format, ip);
+void printNetStats(FILE* file) {
+    char name[32];
 
-        if (result != 1) {
-            while (getchar() != '\n') {}
-            printf("Invalid input\n");
-            continue;
+    if (!is_host) {
+        connStatsPrint(&client.conn, "host", file);
+        fprintf(file, "    input latency:     %"PRIu32" ms\n", client.inputs.latency);
+        if (client.conn.clock.synced) {
+            fprintf(file, "    clock offset:      %+"PRId32" ms (+-%"PRIu32" ms, skew %"PRId32" ppm)\n",
+                client.conn.clock.offset, client.conn.clock.error, client.conn.clock.skew_ppm);
         }
+        return;
+    }
 
-        result = inet_pton(AF_INET, ip, addr);
-        pcr(result, "inet_pton failed");
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = host.room.peers[i];
+        if (!peer || (peer->conn.stats.msgs_in == 0 && peer->conn.stats.msgs_out == 0)) continue;
 
-        if (result == 0) {
-            printf("Invalid IP\n");
-            continue;
+        if (peer->role == ROLE_PLAYER) {
+            snprintf(name, sizeof(name), "player %zu", peer->player_i + 1);
+        } else {
+            snprintf(name, sizeof(name), "connection %zu", i + 1);
+        }
+        connStatsPrint(&peer->conn, name, file);
+        if (peer->role == ROLE_PLAYER) {
+            fprintf(file, "    input delay:       %"PRIu32" ms, %"PRIu64" of %"PRIu64" late\n",
+                peer->input_stats.delay, peer->input_stats.late, peer->input_stats.applied);
         }
+        fprintf(file, "    states:            every %"PRIu32" ticks, radius %d\n", peer->snapshot_interval, peer->radius);
+    }
+
+    fprintf(file, "player 1 (host):\n");
+    fprintf(file, "    input delay:       %"PRIu32" ticks, %"PRIu32" ms\n",
+        host.room.input_delay, host.room.local_input_stats.delay);
+}
 
-        break;
+void clientWelcome(struct Msg* msg) {
+    uint8_t player_i;
+    if (welcomeRead(msg, &player_i, client.token)) {
+        client.is_spectator = player_i == SPECTATOR_I;
+        client.player_i = player_i;
     }
+}
 
-    // Get port
-    while (true) {
-        printf("Choose a port: ");
+// Players resume their slot, spectators just join again
+void clientReconnect() {
+    if (client.gave_up || curr_time - client.lost_at > RESUME_GRACE) {
+        client.gave_up = true;
+        return;
+    }
 
-        // @todo ub in case of overflow
-        int res = scanf("%hu", port);
+    if (!client.connecting) {
+        if (curr_time - client.last_attempt < RECONNECT_DELAY) return;
 
-        if (res != 1 || *port < 1024) {
-            printf("Invalid port\n");
-        } else {
-            break;
-        }
+        client.last_attempt = curr_time;
+        client.connecting = true;
+        netThreadConnect(network.thread, &network.host_addr, RESUME_GRACE);
+        return;
+    }
+
+    struct NetEvent event;
+    int connected = clientConnectPoll(&event);
+    if (connected == 0) return;
+
+    client.connecting = false;
+    if (connected < 0) return;
+
+    // Stats go on over the new connection
+    struct ConnStats stats = client.conn.stats;
+    connInit(&client.conn, event.fd);
+    netThreadAttach(network.thread, event.channel, &client.conn);
+    client.conn.stats = stats;
+
+    client.lost = false;
+
+    if (client.is_spectator) {
+        uint8_t role = ROLE_SPECTATOR;
+        connSend(&client.conn, MSG_JOIN, &role, sizeof(role));
+    } else {
+        connSend(&client.conn, MSG_RESUME, client.token, sizeof(client.token));
     }
+    printf("Reconnected\n");
 }
-/*
-void block(int fd) {
-    pcr(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK),
-        "Error setting O_NONBLOCK"
-       );
+
+void simStop();
+
+// On the main thread, once reconnecting gave up, back to the address to try
+// again
+void clientHostLost() {
+    simStop();
+    networkError("Lost the host");
+
+    // Before the thread, which the connection's rings belong to
+    connClose(&client.conn);
+    netThreadStop(network.thread);
+    network.thread = NULL;
+
+    client.lost = false;
+    client.gave_up = false;
+    client.connecting = false;
+
+    reset(&game_state);
+    mode = MENU;
+    menu_mode = MN_ADDRESS;
 }
-*/
 
-void unblock(int fd) {
-#if defined(__linux__)
-    pcr(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK),
-        "Error setting O_NONBLOCK"
-       );
-#elif defined(WINDOWS)
-    u_long mode = 1;
-    int res = ioctlsocket(fd, FIONBIO, &mode);
-    if (res != NO_ERROR) {
-        fprintf(stderr, "ioctlsocket failed: %d\n", res);
+// Losing the host starts reconnecting, and only if that fails the match
+void clientRecv() {
+    if (client.lost) {
+        clientReconnect();
+        return;
     }
 
-#endif // defined
+    if (!connRecv(&client.conn, curr_time)) {
+        client.lost = true;
+        client.lost_at = curr_time;
+        client.last_attempt = 0;
+        client.connecting = false;
+    }
 }
 
 bool runMenu() {
@@ -925,9 +1063,9 @@ bool runMenu() {
         // @todo close sockets
         // @todo currently read/write ignores endianness
 
-        enum {BUTTONS_QTY = 2};
-        char* msgs[BUTTONS_QTY] = {"Host", "Join"};
-        enum HostOrJoin {HOST, JOIN};
+        enum {BUTTONS_QTY = 3};
+        char* msgs[BUTTONS_QTY] = {"Host", "Join", "Spectate"};
+        enum HostOrJoin {HOST, JOIN, SPECTATE};
 
         SDL_Rect hitboxes[BUTTONS_QTY];
 
@@ -941,112 +1079,90 @@ bool runMenu() {
         if (input.is_mouse_clicked) {
             for (size_t i = 0; i < BUTTONS_QTY; i++) {
                 if (rectContainsPos(&hitboxes[i], &input.mouse_pos)) {
-                    struct in_addr addr;
-                    uint16_t port;
-                    getAddrAndPort(&addr, &port);
-
-                    // @todo check if it is linux
-                    // Init socket
-                    int fd = socket(AF_INET, SOCK_STREAM, 0);
-                    pcr(fd, "Socket creation failed");
-
-                    memset(&network.host_addr, 0, sizeof(network.host_addr));
-                    network.host_addr.sin_family = AF_INET;
-                    network.host_addr.sin_port = htons(port);
-                    network.host_addr.sin_addr = addr;
-
-                    // Bind/Connect
                     switch ((enum HostOrJoin)i) {
                     case HOST: {
-                        is_host = true;
-
-                        host.fd[0] = fd;
-                        game_state.players_size = 1;
-
-                        unblock(host.fd[0]);
-
-                        // @todo use select or poll?
-                        pcr(bind(host.fd[0], (struct sockaddr*)&network.host_addr, sizeof(network.host_addr)),
-                                "Bind failed"
-                           );
-
-                        pcr(listen(host.fd[0], MAX_PLAYERS_SIZE),
-                                "Listening failed"
-                           );
-
-                        printf("Listening\n");
+                        network.role = NET_HOST;
                     } break;
                     case JOIN: {
-                        is_host = false;
-
-                        client.fd = fd;
-
-                        while (true) {
-                            // Original: if errno == EINPROGRESS || connect >= 0 break
-                            int result = connect(fd, (struct sockaddr*) &network.host_addr, sizeof(network.host_addr));
-
-                            if (result < 0) {
-                                if (errno == EINPROGRESS) continue;
-                                else errnoAbort("Connection failed");
-                            }
-
-                            break;
-                        }
-                        printf("Connected\n");
-                        unblock(client.fd);
-
-                        readBytes(client.fd, &client.player_i, sizeof(client.player_i), true);
+                        network.role = NET_JOIN;
+                    } break;
+                    case SPECTATE: {
+                        network.role = NET_SPECTATE;
                     } break;
                     }
 
-                    menu_mode = MN_LOBBY;
+                    network.error[0] = '\0';
+                    menu_mode = MN_ADDRESS;
                 }
             }
         }
     } break;
-    case MN_LOBBY: {
-        enum Type {
-            START_GAME,
-            UPDATE,
-        };
-
-        struct Packet {
-            enum Type type;
-            size_t update_players_size;
-        };
+    case MN_ADDRESS: {
+        // Typed in the window instead of the terminal, so nothing blocks
+        size_t len = strlen(network.address);
+        for (size_t i = 0; i < input.text_size && len + 1 < ADDRESS_SIZE; i++) {
+            char c = input.text[i];
+            if (('0' <= c && c <= '9') || c == '.' || c == ':') {
+                network.address[len++] = c;
+            }
+        }
+        network.address[len] = '\0';
 
-        if (is_host) {
-            socklen_t len = sizeof(network.host_addr);
-            int fd = accept(host.fd[0], (struct sockaddr*) &network.host_addr, &len);
-            if (fd >= 0) {
-                writeBytes(fd, &game_state.players_size, sizeof(game_state.players_size));
+        if (input.is_key_pressed) {
+            switch (input.key_pressed) {
+            case SDLK_BACKSPACE: {
+                if (len > 0) network.address[len-1] = '\0';
+            } break;
+            case SDLK_RETURN:
+            case SDLK_KP_ENTER: {
+                if (networkStart()) menu_mode = MN_LOBBY;
+            } break;
+            case SDLK_ESCAPE: {
+                menu_mode = MN_HOST_OR_JOIN;
+            } break;
+            }
+        }
 
-                unblock(fd);
+        char line[ADDRESS_SIZE + 16];
+        snprintf(line, sizeof(line), "Address: %s_", network.address);
 
-                host.fd[game_state.players_size++] = fd;
-            }
+        char* msgs[3] = {line, "Enter to go, Esc to go back", network.error};
+        size_t msgs_size = network.error[0] != '\0' ? 3 : 2;
 
-            if (curr_time > lobby.start + lobby.delay) {
-                lobby.start = curr_time;
-                for (size_t i = 1; i < game_state.players_size; i++) {
-                    struct Packet packet = {.type = UPDATE, .update_players_size = game_state.players_size};
-                    writeBytes(host.fd[i], &packet, sizeof(packet));
-                }
-            }
+        SDL_Rect hitboxes[3];
+        SDL_Color colors[3] = {menu.button_color, menu.button_color, menu.button_color};
+        renderMsgsCentered(msgs, msgs_size, hitboxes, colors);
+    } break;
+    case MN_LOBBY: {
+        if (is_host) {
+            hostAccept();
+            hostRecv();
+            roomLobbyUpdate(&host.room, curr_time);
+        } else if (client.connecting) {
+            clientConnect();
         } else {
-            while (true) {
-                struct Packet packet;
-                if (!readBytes(client.fd, &packet, sizeof(packet), false)) {
-                    break;
-                }
+            clientRecv();
+            if (client.gave_up) {
+                clientHostLost();
+                return true;
+            }
 
-                switch (packet.type) {
-                case UPDATE: {
-                    game_state.players_size = packet.update_players_size;
+            struct Msg msg;
+            while (connNextMsg(&client.conn, &msg)) {
+                switch (msg.type) {
+                case MSG_WELCOME: {
+                    clientWelcome(&msg);
                 } break;
-                case START_GAME: {
+                case MSG_LOBBY_UPDATE: {
+                    if (msg.size == 1 && msg.data[0] <= MAX_PLAYERS_SIZE) {
+                        game_state.players_size = msg.data[0];
+                    }
+                } break;
+                case MSG_START_GAME: {
+                    startGameRead(&msg, &client.input_delay);
                     mode = RUNNING;
                 } break;
+                default: break;
                 }
             }
         }
@@ -1083,10 +1199,7 @@ bool runMenu() {
             if (is_host) {
                 if (rectContainsPos(&hitboxes[READY_BUTTON], &input.mouse_pos)) {
                     mode = RUNNING;
-                    for (size_t i = 1; i < game_state.players_size; i++) {
-                        struct Packet packet = {.type = START_GAME};
-                        writeBytes(host.fd[i], &packet, sizeof(packet));
-                    }
+                    roomStart(&host.room);
                 }
             }
         }
@@ -1167,7 +1280,7 @@ bool runMenu() {
             for (size_t i = 0; i < BUTTONS_QTY; i++) {
                 size_t len = strlen(msg[i]);
 
-                SDL_Keycode key = game_state.players[remap_menu.sel_player_i].bindings[i];
+                SDL_Keycode key = bindings[remap_menu.sel_player_i][i];
 
                 if (key <= 0x7F) {
                     msg[i][len-1] = (char)key;
@@ -1232,7 +1345,7 @@ bool runMenu() {
             if (input.is_key_pressed && input.key_pressed == SDLK_ESCAPE) {
                 menu_mode = MN_OPTIONS_MENU;
             } else if (remap_menu.button_sel && validKey(input.key_pressed)) {
-                game_state.players[remap_menu.sel_player_i].bindings[remap_menu.button_sel_i] = input.key_pressed;
+                bindings[remap_menu.sel_player_i][remap_menu.button_sel_i] = input.key_pressed;
                 remap_menu.button_sel = false;
             }
         }
@@ -1276,7 +1389,7 @@ bool runMenu() {
             }
             if (remap_menu.button_sel) {
                 remap_menu.button_sel = false;
-                game_state.players[remap_menu.sel_player_i].bindings[remap_menu.button_sel_i] = input.key_pressed;
+                bindings[remap_menu.sel_player_i][remap_menu.button_sel_i] = input.key_pressed;
             }
         }
         if (input.is_mouse_clicked) {
@@ -1296,95 +1409,268 @@ bool runMenu() {
     return true;
 }
 
-void runRunning() {
-    bool all_died = true;
-    for (size_t i = 0; i < game_state.players_size; i++) {
-        if (!game_state.players[i].game_over) all_died = false;
-    }
-
-    if (all_died) {
-        mode = GAME_OVER;
-        game_over.start = curr_time;
-        already_running = false;
+// A key pressed on the main thread, on the simulation's
+void simKey(SDL_Keycode key) {
+    if (is_online) {
+        if (is_host) {
+            enum Direction direc;
+            if (mapKeycode(bindings[0], key, &direc)) {
+                roomLocalInput(&host.room, direc);
+            }
+        } else if (!client.is_spectator) {
+            enum Direction direc;
+            if (mapKeycode(bindings[client.player_i], key, &direc)) {
+                uint32_t tick = game_state.tick;
+                if (client.conn.clock.synced) {
+                    tick = matchClockTick(&client.match_clock, connRemoteTime(&client.conn, curr_time));
+                }
+                inputHistoryAdd(&client.inputs, &client.conn, direc, tick + client.input_delay, curr_time);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < game_state.players_size; i++) {
+            if (!game_state.players[i].game_over) {
+                enum Direction direc;
+                if (mapKeycode(bindings[i], key, &direc)) {
+                    addDirection(&game_state.players[i], direc);
+                }
+            }
+        }
     }
+}
 
+void simTick() {
     // ==========
     // Input
     // ==========
 
-    // Get online directions
+    // Get online directions, spectators can still come in
     if (is_online && is_host) {
-        for (size_t i = 1; i < game_state.players_size; i++) {
-            while (true) {
-                enum Direction direc;
-                if (!readBytes(host.fd[i], &direc, sizeof(direc), false)) {
-                    break;
-                }
-                addDirection(&game_state.players[i], direc);
-            }
-        }
+        hostAccept();
+        hostRecv();
     }
 
     // Events
-    if (input.key_pressed) {
-        if (is_online) {
-            if (is_host) {
-                enum Direction direc;
-                if (mapKeycode(game_state.players[0].bindings, input.key_pressed, &direc)) {
-                    addDirection(&game_state.players[0], direc);
-                }
-            } else {
-                enum Direction direc;
-                if (mapKeycode(game_state.players[client.player_i].bindings, input.key_pressed, &direc)) {
-                    writeBytes(client.fd, &direc, sizeof(direc));
-                }
-            }
-        } else {
-            if (input.key_pressed == SDLK_ESCAPE) {
-                mode = MENU;
-            } else {
-                for (size_t i = 0; i < game_state.players_size; i++) {
-                    if (!game_state.players[i].game_over) {
-                        enum Direction direc;
-                        if (mapKeycode(game_state.players[i].bindings, input.key_pressed, &direc)) {
-                            addDirection(&game_state.players[i], direc);
-                        }
-                    }
-                }
-            }
-        }
+    uint32_t tail = __atomic_load_n(&sim.keys_tail, __ATOMIC_ACQUIRE);
+    while (sim.keys_head != tail) {
+        simKey(sim.keys[sim.keys_head % SIM_KEYS_SIZE]);
+        __atomic_store_n(&sim.keys_head, sim.keys_head + 1, __ATOMIC_RELEASE);
     }
 
     // Update
+    uint64_t tick_start = netNowUs();
+
+    if (is_online && is_host) {
+        roomApplyInputs(&host.room);
+    }
     if (!(is_online && !is_host)) {
         gameStateUpdate(&game_state, curr_time);
     }
 
     if (is_online) {
         if (is_host) {
-            for (size_t i = 1; i < game_state.players_size; i++) {
-                writeBytes(host.fd[i], &game_state, sizeof(game_state));
+            roomBroadcastState(&host.room, curr_time);
+
+            tickTimesAdd(&host.tick_times, netNowUs() - tick_start);
+
+            struct TickStats stats;
+            if (tickTimesStats(&host.tick_times, curr_time, &stats)) {
+                uint8_t data[TICK_STATS_SIZE];
+                tickStatsWrite(data, &stats);
+                roomBroadcast(&host.room, MSG_TICK_STATS, data, sizeof(data));
             }
         } else {
-            while (true) {
-                struct GameState temp;
-                if (!readBytes(client.fd, &temp, sizeof(temp), false)) {
-                    break;
+            clientRecv();
+
+            // Only the newest state is worth copying
+            struct Msg latest = {0};
+            uint32_t latest_tick = game_state.tick;
+            struct Msg msg;
+            while (connNextMsg(&client.conn, &msg)) {
+                uint32_t tick;
+                if (stateTick(&msg, &tick)) {
+                    // Older ones can come late if the network reorders them
+                    if (latest.data || tick < latest_tick) client.conn.stats.snapshots_skipped++;
+                    if (tick < latest_tick) continue;
+
+                    latest = msg;
+                    latest_tick = tick;
+                } else if (tickStatsRead(&msg, &client.host_ticks)) {
+                    client.has_host_ticks = true;
+                } else if (msg.type == MSG_WELCOME) {
+                    clientWelcome(&msg);
+                } else if (msg.type == MSG_START_GAME) {
+                    // A new match or a new connection, ticks start over
+                    latest.data = NULL;
+                    latest_tick = 0;
+                    client.match_clock.started = false;
+                    startGameRead(&msg, &client.input_delay);
+                }
+            }
+            if (latest.data) {
+                uint32_t time;
+                if (stateTime(&latest, &time)) {
+                    matchClockUpdate(&client.match_clock, latest_tick, time);
                 }
-                game_state = temp;
+                stateRead(&latest, &game_state);
+            }
+
+            if (!client.is_spectator) {
+                uint32_t ack = game_state.players[client.player_i].last_input_seq;
+                inputHistoryAck(&client.inputs, &client.conn, ack, curr_time, NULL);
             }
         }
     }
+}
 
-    // Render
+void simSnapshot(struct Snapshot* snapshot) {
+    snapshot->game_state = game_state;
+
+    snapshot->game_over = true;
     for (size_t i = 0; i < game_state.players_size; i++) {
-        if (game_state.players[i].score > 999) {
+        if (!game_state.players[i].game_over) snapshot->game_over = false;
+    }
+
+    snapshot->lost = is_online && !is_host && client.lost;
+    snapshot->host_lost = is_online && !is_host && client.gave_up;
+    snapshot->net_stats_size = is_online ? formatNetStats(snapshot->net_stats, NET_STATS_LINES) : 0;
+}
+
+// Hand queued bytes to the net thread. A player the host had to drop is out
+// of the match.
+void flushConns() {
+    if (is_host) {
+        roomFlush(&host.room, curr_time);
+    } else {
+        connFlush(&client.conn, curr_time);
+    }
+
+    if (network.thread) netThreadWake(network.thread);
+}
+
+// Until stopped, the match is over or the host is lost
+int simRun(void* data) {
+    (void)data;
+
+    uint32_t next_tick = SDL_GetTicks();
+    while (!__atomic_load_n(&sim.stop, __ATOMIC_ACQUIRE)) {
+        curr_time = SDL_GetTicks();
+        if ((int32_t)(next_tick - curr_time) > 0) {
+            SDL_Delay(next_tick - curr_time);
+            continue;
+        }
+
+        // Don't try to catch up on ticks missed while overloaded
+        next_tick += DEFAULT_TICK_TIME;
+        if ((int32_t)(curr_time - next_tick) > 0) next_tick = curr_time;
+
+        simTick();
+        if (is_online) {
+            flushConns();
+        }
+
+        struct Snapshot* snapshot = &sim.snapshots[tripleBufferBack(&sim.buffer)];
+        simSnapshot(snapshot);
+        tripleBufferPublish(&sim.buffer);
+
+        if (snapshot->game_over || snapshot->host_lost) break;
+    }
+
+    return 0;
+}
+
+bool simStart() {
+    sim.stop = false;
+    sim.keys_head = 0;
+    sim.keys_tail = 0;
+
+    // Something to draw before the first tick
+    tripleBufferInit(&sim.buffer);
+    simSnapshot(&sim.snapshots[tripleBufferFront(&sim.buffer)]);
+
+    sim.thread = SDL_CreateThread(simRun, "simulation", NULL);
+    if (!sim.thread) {
+        printSdlError("simStart");
+        return false;
+    }
+    return true;
+}
+
+// game_state and the network are the main thread's again after
+void simStop() {
+    if (!sim.thread) return;
+
+    __atomic_store_n(&sim.stop, true, __ATOMIC_RELEASE);
+    SDL_WaitThread(sim.thread, NULL);
+    sim.thread = NULL;
+}
+
+// Dropped if the simulation is that far behind
+void simPushKey(SDL_Keycode key) {
+    uint32_t head = __atomic_load_n(&sim.keys_head, __ATOMIC_ACQUIRE);
+    if (sim.keys_tail - head == SIM_KEYS_SIZE) return;
+
+    sim.keys[sim.keys_tail % SIM_KEYS_SIZE] = key;
+    __atomic_store_n(&sim.keys_tail, sim.keys_tail + 1, __ATOMIC_RELEASE);
+}
+
+// The window's side of a match, the simulation ticks on its own thread
+bool runRunning() {
+    if (!sim.thread && !simStart()) return false;
+
+    // Events
+    if (input.is_key_pressed && input.key_pressed == SDLK_F3) {
+        show_net_stats = !show_net_stats;
+    }
+
+    if (input.key_pressed) {
+        if (!is_online && input.key_pressed == SDLK_ESCAPE) {
+            simStop();
+            mode = MENU;
+            return true;
+        }
+        simPushKey(input.key_pressed);
+    }
+
+    tripleBufferUpdate(&sim.buffer);
+    struct Snapshot* snapshot = &sim.snapshots[tripleBufferFront(&sim.buffer)];
+
+    if (snapshot->host_lost) {
+        clientHostLost();
+        return true;
+    }
+
+    if (snapshot->game_over) {
+        simStop();
+        mode = GAME_OVER;
+        game_over.start = curr_time;
+        already_running = false;
+    }
+
+    // Render
+    for (size_t i = 0; i < snapshot->game_state.players_size; i++) {
+        if (snapshot->game_state.players[i].score > 999) {
             fprintf(stderr, "Score too big!\n");
             exit(-1);
         }
     }
 
-    render(&game_state);
+    render(&snapshot->game_state);
+
+    if (is_online && show_net_stats) {
+        renderNetStats(snapshot);
+    }
+
+    if (snapshot->lost) {
+        SDL_Color color = {0xFF, 0xFF, 0xFF, 0xFF};
+        SDL_Rect rect;
+        TTF_SizeText(small_font, "Reconnecting...", &rect.w, &rect.h);
+        rect.x = WINDOW_WIDTH/2 - rect.w/2;
+        rect.y = 0;
+        renderStaticText(&small_font_atlas, "Reconnecting...", &rect, color);
+    }
+
+    return true;
 }
 
 void runGameOver() {
@@ -1429,9 +1715,124 @@ void runGameOver() {
     renderMsg(msg, &game_over_rect, menu.button_color);
 }
 
+void usage(char* program) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "\n"
+        "Without options the menus ask for everything.\n"
+        "    --host ADDRESS     host online on IP:PORT, or PORT on every address\n"
+        "    --join ADDRESS     join the host at IP:PORT, or PORT on this machine\n"
+        "    --spectate ADDRESS watch the host at IP:PORT\n"
+        "    --players N        local players (default 1)\n"
+        "    --input-delay TICKS when hosting, how long every input waits, auto to fit\n"
+        "                       the farthest player (default auto)\n"
+        "    --fps N            frames per second, vsync to follow the display or\n"
+        "                       uncapped (default 60)\n"
+        "    --seed N\n"
+        "    --config FILE      read options from FILE, one \"option value\" per line\n",
+        program
+    );
+    exit(EXIT_FAILURE);
+}
+
+void loadConfig(char* program, char* path);
+// Set while a config file is read, which can't name another one
+static char* config_path = NULL;
+
+// `option` is given without its leading dashes
+void applyOption(char* program, char* option, char* value) {
+    if (strcmp(option, "host") == 0 || strcmp(option, "join") == 0 || strcmp(option, "spectate") == 0) {
+        if (strlen(value) >= ADDRESS_SIZE) usage(program);
+
+        options.autostart = true;
+        if (strcmp(option, "host") == 0) options.role = NET_HOST;
+        else if (strcmp(option, "join") == 0) options.role = NET_JOIN;
+        else options.role = NET_SPECTATE;
+        strcpy(network.address, value);
+    } else if (strcmp(option, "players") == 0) {
+        char* end;
+        long players_size = strtol(value, &end, 10);
+        if (*end != '\0' || players_size < 1 || players_size > MAX_PLAYERS_SIZE) usage(program);
+        options.players_size = players_size;
+    } else if (strcmp(option, "input-delay") == 0) {
+        if (strcmp(value, "auto") == 0) {
+            options.input_delay = INPUT_DELAY_AUTO;
+        } else {
+            char* end;
+            long input_delay = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || input_delay < 0 || input_delay > MAX_INPUT_DELAY) usage(program);
+            options.input_delay = input_delay;
+        }
+    } else if (strcmp(option, "fps") == 0) {
+        if (strcmp(value, "vsync") == 0) {
+            options.frame_mode = FRAME_VSYNC;
+        } else if (strcmp(value, "uncapped") == 0) {
+            options.frame_mode = FRAME_UNCAPPED;
+        } else {
+            char* end;
+            long frame_rate = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || frame_rate < 1 || frame_rate > 1000) usage(program);
+            options.frame_mode = FRAME_CAPPED;
+            options.frame_rate = frame_rate;
+        }
+    } else if (strcmp(option, "seed") == 0) {
+        char* end;
+        options.seed = strtoul(value, &end, 10);
+        if (*value == '\0' || *end != '\0') usage(program);
+        options.has_seed = true;
+    } else if (strcmp(option, "config") == 0) {
+        if (config_path) {
+            fprintf(stderr, "%s: config can only be given on the command line\n", config_path);
+            usage(program);
+        }
+        loadConfig(program, value);
+    } else {
+        fprintf(stderr, "Unknown option: %s\n", option);
+        usage(program);
+    }
+}
+
+// Same options as the command line, "#" starts a comment
+void loadConfig(char* program, char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    config_path = path;
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char option[32];
+        char value[64];
+        int read = sscanf(line, " %31s %63s", option, value);
+        if (read <= 0) continue;
+
+        if (read != 2) {
+            fprintf(stderr, "%s: expected \"option value\": %s", path, line);
+            usage(program);
+        }
+        applyOption(program, option, value);
+    }
+
+    config_path = NULL;
+    fclose(file);
+}
+
+void parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) usage(argv[0]);
+
+        applyOption(argv[0], argv[i] + 2, argv[i+1]);
+        i++;
+    }
+}
+
 int main(int argc, char** argv) {
-    (void)argc;
-    (void)argv;
+    parseArgs(argc, argv);
 
 #ifdef WINDOWS
     WSADATA wsa_data;
@@ -1443,30 +1844,33 @@ int main(int argc, char** argv) {
 
     int ret = 0;
 
-    srand(time(NULL));
+    srand(options.has_seed ? options.seed : time(NULL));
 
-    if (!init()) {
+    if (!init(options.frame_mode == FRAME_VSYNC)) {
         return_defer(-1);
     }
 
     if (!loadMedia()) {
         return_defer(-1);
     }
+    boardCacheInit();
 
     reset(&game_state);
+    game_state.players_size = options.players_size;
 
-    // Set initial bindings
-    SDL_Keycode bindings[MAX_PLAYERS_SIZE][4] = {
-        {SDLK_s, SDLK_a, SDLK_d, SDLK_w},
-        {SDLK_DOWN, SDLK_LEFT, SDLK_RIGHT, SDLK_UP},
-        {SDLK_g, SDLK_f, SDLK_h, SDLK_t},
-        {SDLK_k, SDLK_j, SDLK_l, SDLK_i}
-    };
-
-    for (size_t i = 0; i < MAX_PLAYERS_SIZE; i++) {
-        memcpy(&game_state.players[i].bindings, bindings[i], sizeof(SDL_Keycode)*4);
+    // Straight to the lobby, a failure here is final
+    if (options.autostart) {
+        curr_time = SDL_GetTicks();
+        is_online = true;
+        network.role = options.role;
+        if (!networkStart()) {
+            return_defer(-1);
+        }
+        menu_mode = MN_LOBBY;
     }
 
+    framePacerInit(&frame_pacer, options.frame_mode, options.frame_rate);
+
     // Main switch
     while (true) {
         curr_time = SDL_GetTicks();
@@ -1483,7 +1887,9 @@ int main(int argc, char** argv) {
             }
         } break;
         case RUNNING: {
-            runRunning();
+            if (!runRunning()) {
+                return_defer(-1);
+            }
         } break;
         case GAME_OVER: {
             runGameOver();
@@ -1493,17 +1899,36 @@ int main(int argc, char** argv) {
         } break;
         }
 
+        // The simulation flushes its own
+        if (is_online && !sim.thread) {
+            flushConns();
+        }
+
         SDL_RenderPresent(renderer);
-        SDL_Delay(1000 / 60);
+        framePacerWait(&frame_pacer);
     }
 
 defer:
+    simStop();
+    // Before the sockets go away with WSACleanup
+    if (network.thread) netThreadStop(network.thread);
+
 #ifdef WINDOWS
     WSACleanup();
 #endif
 
-    if (body_text) SDL_DestroyTexture(body_text);
-    if (head_text) SDL_DestroyTexture(head_text);
+    spriteAtlasFree(&sprite_atlas);
+    if (is_online) {
+        printNetStats(stdout);
+    }
+    framePacerPrint(&frame_pacer, stdout);
+
+    boardCacheFree();
+    textCacheFree(&text_cache);
+    glyphAtlasFree(&small_font_atlas);
+    glyphAtlasFree(&font_atlas);
+
+    if (small_font) TTF_CloseFont(small_font);
     if (font) TTF_CloseFont(font);
 
     if (renderer) SDL_DestroyRenderer(renderer);
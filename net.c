@@ -0,0 +1,731 @@
+#if defined(__linux__)
+// clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#include "net.h"
+
+#if defined(__linux__)
+#include <time.h>
+#include <sys/select.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+
+uint64_t net_syscalls;
+
+void errnoAbort(char* message) {
+    perror(message);
+    exit(-1);
+}
+
+// posix check error
+int pcr(int ret, char* message) {
+    if (ret < 0) errnoAbort(message);
+
+    return ret;
+}
+
+// posix check pointer
+void* pcp(void* p, char* message) {
+    if (!p) errnoAbort(message);
+
+    return p;
+}
+
+void writeU16(uint8_t* p, uint16_t x) {
+    x = htons(x);
+    memcpy(p, &x, sizeof(x));
+}
+
+void writeU32(uint8_t* p, uint32_t x) {
+    x = htonl(x);
+    memcpy(p, &x, sizeof(x));
+}
+
+uint16_t readU16(uint8_t* p) {
+    uint16_t x;
+    memcpy(&x, p, sizeof(x));
+    return ntohs(x);
+}
+
+uint32_t readU32(uint8_t* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return ntohl(x);
+}
+
+uint32_t netNow() {
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000 + ts.tv_nsec/1000000;
+#elif defined(WINDOWS)
+    return GetTickCount();
+#endif // defined
+}
+
+uint64_t netNowUs() {
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#elif defined(WINDOWS)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return count.QuadPart / freq.QuadPart * 1000000 + count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+#endif // defined
+}
+
+/*
+void block(int fd) {
+    pcr(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK),
+        "Error setting O_NONBLOCK"
+       );
+}
+*/
+
+void unblock(int fd) {
+#if defined(__linux__)
+    pcr(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK),
+        "Error setting O_NONBLOCK"
+       );
+#elif defined(WINDOWS)
+    u_long mode = 1;
+    int res = ioctlsocket(fd, FIONBIO, &mode);
+    if (res != NO_ERROR) {
+        fprintf(stderr, "ioctlsocket failed: %d\n", res);
+    }
+
+#endif // defined
+}
+
+void closeFd(int fd) {
+#if defined(__linux__)
+    close(fd);
+#elif defined(WINDOWS)
+    closesocket(fd);
+#endif // defined
+}
+
+void connInit(struct Conn* conn, int fd) {
+    conn->fd = fd;
+    conn->open = true;
+    conn->relay = false;
+    conn->recv_chunk = 0;
+    conn->io = NULL;
+    conn->io_ctx = NULL;
+
+    conn->send_head = 0;
+    conn->send_size = 0;
+
+    conn->pending = NULL;
+    conn->sending = NULL;
+    conn->sending_off = 0;
+
+    conn->stall_start = 0;
+
+    conn->recv_start = 0;
+    conn->recv_end = 0;
+    conn->recv_time = 0;
+
+    conn->last_ping = 0;
+    memset(&conn->stats, 0, sizeof(conn->stats));
+    memset(&conn->clock, 0, sizeof(conn->clock));
+}
+
+void connClose(struct Conn* conn) {
+    if (!conn->open) return;
+
+    if (conn->io) {
+        conn->io->close(conn->io_ctx);
+        conn->io = NULL;
+    }
+    if (conn->fd >= 0) closeFd(conn->fd);
+
+    conn->open = false;
+    conn->send_size = 0;
+
+    if (conn->pending) sharedBufUnref(conn->pending);
+    if (conn->sending) sharedBufUnref(conn->sending);
+    conn->pending = NULL;
+    conn->sending = NULL;
+}
+
+static void sendQueuePush(struct Conn* conn, void* data, size_t data_size) {
+    assert(conn->send_size + data_size <= SEND_QUEUE_SIZE);
+
+    size_t tail = (conn->send_head + conn->send_size) % SEND_QUEUE_SIZE;
+    size_t first = SEND_QUEUE_SIZE - tail;
+    if (first > data_size) first = data_size;
+
+    memcpy(&conn->send_queue[tail], data, first);
+    memcpy(conn->send_queue, (uint8_t*)data + first, data_size - first);
+
+    conn->send_size += data_size;
+}
+
+static void msgHeaderWrite(uint8_t* header, enum MsgType type, size_t data_size) {
+    writeU16(header, type);
+    writeU32(header + 2, data_size);
+}
+
+/*
+ * Queue a message that must arrive. Returns false and closes the connection
+ * if the queue is full, since the peer has stopped reading.
+ * */
+bool connSend(struct Conn* conn, enum MsgType type, void* data, size_t data_size) {
+    if (!conn->open) return false;
+
+    if (conn->send_size + MSG_HEADER_SIZE + data_size > SEND_QUEUE_SIZE) {
+        fprintf(stderr, "Send queue full, dropping connection\n");
+        connClose(conn);
+        return false;
+    }
+
+    uint8_t header[MSG_HEADER_SIZE];
+    msgHeaderWrite(header, type, data_size);
+
+    sendQueuePush(conn, header, MSG_HEADER_SIZE);
+    if (data_size > 0) {
+        sendQueuePush(conn, data, data_size);
+    }
+
+    conn->stats.msgs_out++;
+    return true;
+}
+
+struct SharedBuf* sharedBufNew(enum MsgType type, void* data, size_t data_size) {
+    struct SharedBuf* buf = pcp(malloc(sizeof(*buf) + MSG_HEADER_SIZE + data_size), "malloc failed");
+
+    buf->refs = 1;
+    buf->size = MSG_HEADER_SIZE + data_size;
+
+    msgHeaderWrite(buf->data, type, data_size);
+    memcpy(buf->data + MSG_HEADER_SIZE, data, data_size);
+
+    return buf;
+}
+
+struct SharedBuf* sharedBufRef(struct SharedBuf* buf) {
+    buf->refs++;
+    return buf;
+}
+
+void sharedBufUnref(struct SharedBuf* buf) {
+    assert(buf->refs > 0);
+
+    if (--buf->refs == 0) {
+        free(buf);
+    }
+}
+
+/*
+ * Queue a snapshot that is superseded by the next one. It's only written
+ * once everything before it has reached the socket; until then it waits in
+ * pending and is replaced by any newer snapshot.
+ * */
+void connSendSnapshot(struct Conn* conn, struct SharedBuf* buf, uint32_t now) {
+    if (!conn->open) return;
+
+    if (conn->pending) {
+        sharedBufUnref(conn->pending);
+        conn->stats.snapshots_dropped++;
+    } else {
+        conn->stall_start = now;
+    }
+
+    conn->pending = sharedBufRef(buf);
+}
+
+static bool wouldBlock() {
+#if defined(__linux__)
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#elif defined(WINDOWS)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#endif // defined
+}
+
+static bool connectInProgress() {
+#if defined(__linux__)
+    return errno == EINPROGRESS;
+#elif defined(WINDOWS)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#endif // defined
+}
+
+// Starts connecting without blocking, with a receive buffer of rcvbuf bytes
+// unless it's 0. Returns the socket, or -1 if it failed right away.
+int netConnectStart(struct sockaddr_in* addr, int rcvbuf) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    // Before connecting, the window is agreed on then
+    if (rcvbuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char*)&rcvbuf, sizeof(rcvbuf));
+    unblock(fd);
+
+    if (connect(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0 && !connectInProgress()) {
+        closeFd(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// 1 once connected, 0 while still connecting and -1 if it failed
+int netConnectPoll(int fd) {
+    fd_set write_fds;
+    fd_set except_fds;
+    FD_ZERO(&write_fds);
+    FD_ZERO(&except_fds);
+    FD_SET(fd, &write_fds);
+    FD_SET(fd, &except_fds);
+
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 0};
+    int ready = select(fd + 1, NULL, &write_fds, &except_fds, &timeout);
+    if (ready < 0) return -1;
+    if (ready == 0) return 0;
+
+    // Windows reports failed connects as exceptions
+    if (FD_ISSET(fd, &except_fds)) return -1;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)&err, &len) < 0 || err != 0) return -1;
+
+    return 1;
+}
+
+// Returns bytes written, 0 if the socket is full and -1 if the connection was closed
+static int connWrite(struct Conn* conn, uint8_t* data, size_t data_size) {
+    if (conn->io) {
+        int ret = conn->io->write(conn->io_ctx, data, data_size);
+        if (ret < 0) {
+            connClose(conn);
+            return -1;
+        }
+
+        conn->stats.bytes_out += ret;
+        return ret;
+    }
+
+#ifdef __linux__
+    ssize_t ret = send(conn->fd, data, data_size, MSG_NOSIGNAL);
+#elif defined(WINDOWS)
+    int ret = send(conn->fd, (char*)data, data_size, 0);
+#endif // defined
+    net_syscalls++;
+
+    if (ret < 0) {
+        if (wouldBlock()) return 0;
+
+        perror("Write error");
+        connClose(conn);
+        return -1;
+    }
+
+    conn->stats.bytes_out += ret;
+    return ret;
+}
+
+// Returns true if everything was written
+static bool sendingFlush(struct Conn* conn) {
+    while (conn->sending) {
+        int ret = connWrite(conn, conn->sending->data + conn->sending_off, conn->sending->size - conn->sending_off);
+        if (ret <= 0) return false;
+
+        conn->sending_off += ret;
+        if (conn->sending_off == conn->sending->size) {
+            sharedBufUnref(conn->sending);
+            conn->sending = NULL;
+        }
+    }
+
+    return true;
+}
+
+// Returns true if everything was written
+static bool sendQueueFlush(struct Conn* conn) {
+    while (conn->send_size > 0) {
+        size_t chunk = SEND_QUEUE_SIZE - conn->send_head;
+        if (chunk > conn->send_size) chunk = conn->send_size;
+
+        int ret = connWrite(conn, &conn->send_queue[conn->send_head], chunk);
+        if (ret <= 0) return false;
+
+        conn->send_head = (conn->send_head + ret) % SEND_QUEUE_SIZE;
+        conn->send_size -= ret;
+    }
+
+    return true;
+}
+
+// Written to the socket but not acknowledged by the other end yet. Only
+// Linux tells, elsewhere it's all taken as delivered.
+uint32_t netKernelUnsent(int fd) {
+#if defined(__linux__)
+    net_syscalls++;
+    int unsent = 0;
+    if (ioctl(fd, SIOCOUTQ, &unsent) < 0) return 0;
+    return unsent;
+#elif defined(WINDOWS)
+    (void)fd;
+    return 0;
+#endif // defined
+}
+
+static void statsUpdate(struct Conn* conn, uint32_t now) {
+    struct ConnStats* stats = &conn->stats;
+
+    uint32_t elapsed = now - stats->period_start;
+    if (elapsed < STATS_PERIOD) return;
+
+    // What the socket took, less what's still sitting in it
+    uint32_t kernel_unsent = conn->io && conn->io->unsent ? conn->io->unsent(conn->io_ctx) : netKernelUnsent(conn->fd);
+    int64_t delivered = (int64_t)(stats->bytes_out - stats->period_bytes_out) + stats->period_kernel_unsent - kernel_unsent;
+    stats->delivered_rate = delivered > 0 ? delivered * 1000 / elapsed : 0;
+    stats->unsent = kernel_unsent + connQueuedBytes(conn);
+    stats->period_kernel_unsent = kernel_unsent;
+
+    stats->bytes_in_rate = (stats->bytes_in - stats->period_bytes_in) * 1000 / elapsed;
+    stats->bytes_out_rate = (stats->bytes_out - stats->period_bytes_out) * 1000 / elapsed;
+    stats->msgs_in_rate = (stats->msgs_in - stats->period_msgs_in) * 1000 / elapsed;
+    stats->msgs_out_rate = (stats->msgs_out - stats->period_msgs_out) * 1000 / elapsed;
+
+    stats->period_start = now;
+    stats->period_bytes_in = stats->bytes_in;
+    stats->period_bytes_out = stats->bytes_out;
+    stats->period_msgs_in = stats->msgs_in;
+    stats->period_msgs_out = stats->msgs_out;
+}
+
+/*
+ * Write as much as the socket takes without blocking. Returns false once the
+ * connection is closed, either by an error or by the peer falling behind for
+ * longer than CONN_STALL_TIMEOUT.
+ * */
+bool connFlush(struct Conn* conn, uint32_t now) {
+    if (!conn->open) return false;
+
+    uint32_t ping_interval = conn->clock.samples_size < CLOCK_SAMPLES_MIN ? PING_FAST_INTERVAL : PING_INTERVAL;
+    if (!conn->relay && now - conn->last_ping >= ping_interval) {
+        conn->last_ping = now;
+
+        uint8_t data[4];
+        writeU32(data, now);
+        connSend(conn, MSG_PING, data, sizeof(data));
+    }
+
+    // Reliable messages queued while a snapshot was being written go after it
+    if (sendingFlush(conn) && sendQueueFlush(conn) && conn->pending) {
+        conn->sending = conn->pending;
+        conn->sending_off = 0;
+        conn->pending = NULL;
+        conn->stats.msgs_out++;
+
+        sendingFlush(conn);
+    }
+    if (!conn->open) return false;
+
+    if (conn->pending && now - conn->stall_start > CONN_STALL_TIMEOUT) {
+        fprintf(stderr, "Connection fell behind, dropping it\n");
+        connClose(conn);
+        return false;
+    }
+
+    statsUpdate(conn, now);
+    return true;
+}
+
+// Move the incomplete tail to the front
+static void recvCompact(struct Conn* conn) {
+    if (conn->recv_start > 0) {
+        memmove(conn->recv_buff, &conn->recv_buff[conn->recv_start], conn->recv_end - conn->recv_start);
+        conn->recv_end -= conn->recv_start;
+        conn->recv_start = 0;
+    }
+}
+
+/*
+ * Read everything the socket has into the receive buffer. Messages already
+ * handed out by connNextMsg are discarded first, so payload pointers from
+ * before this call are invalidated. Returns false once the connection is
+ * closed.
+ * */
+bool connRecv(struct Conn* conn, uint32_t now) {
+    if (!conn->open) return false;
+
+    conn->recv_time = now;
+    recvCompact(conn);
+
+    // Fed by the backend instead
+    if (conn->io && !conn->io->read) return true;
+
+    size_t recv_max = RECV_BUFF_SIZE;
+    if (conn->recv_chunk && conn->recv_end + conn->recv_chunk < recv_max) {
+        recv_max = conn->recv_end + conn->recv_chunk;
+    }
+
+    while (conn->recv_end < recv_max) {
+        if (conn->io) {
+            int bytes = conn->io->read(conn->io_ctx, &conn->recv_buff[conn->recv_end], recv_max - conn->recv_end);
+            if (bytes == 0) return true;
+
+            if (bytes < 0) {
+                fprintf(stderr, "Disconnected\n");
+                connClose(conn);
+                return false;
+            }
+
+            conn->recv_end += bytes;
+            conn->stats.bytes_in += bytes;
+            continue;
+        }
+
+#ifdef __linux__
+        ssize_t bytes = recv(conn->fd, &conn->recv_buff[conn->recv_end], recv_max - conn->recv_end, 0);
+#elif defined(WINDOWS)
+        int bytes = recv(conn->fd, (char*)&conn->recv_buff[conn->recv_end], recv_max - conn->recv_end, 0);
+#endif // defined
+        net_syscalls++;
+
+        if (bytes < 0) {
+            if (wouldBlock()) return true;
+
+            perror("read failed");
+            connClose(conn);
+            return false;
+        }
+
+        if (bytes == 0) {
+            fprintf(stderr, "Disconnected\n");
+            connClose(conn);
+            return false;
+        }
+
+        conn->recv_end += bytes;
+        conn->stats.bytes_in += bytes;
+    }
+
+    return true;
+}
+
+void connSetIo(struct Conn* conn, const struct ConnIo* io, void* ctx) {
+    conn->io = io;
+    conn->io_ctx = ctx;
+}
+
+/*
+ * What a backend received for the connection, see struct ConnIo. Like
+ * connRecv, it drops the messages already handed out. Returns false and
+ * closes the connection if it doesn't fit.
+ * */
+bool connFeed(struct Conn* conn, uint8_t* data, size_t data_size) {
+    if (!conn->open) return false;
+
+    if (conn->recv_end + data_size > RECV_BUFF_SIZE) recvCompact(conn);
+    if (conn->recv_end + data_size > RECV_BUFF_SIZE) {
+        fprintf(stderr, "Receive buffer full, dropping connection\n");
+        connClose(conn);
+        return false;
+    }
+
+    memcpy(&conn->recv_buff[conn->recv_end], data, data_size);
+    conn->recv_end += data_size;
+    conn->stats.bytes_in += data_size;
+    return true;
+}
+
+static void rttSample(struct ConnStats* stats, uint32_t rtt) {
+    if (!stats->has_rtt) {
+        stats->has_rtt = true;
+        stats->rtt = rtt;
+        stats->rtt_min = rtt;
+        return;
+    }
+
+    stats->rtt = (stats->rtt*7 + rtt) / 8;
+    if (rtt < stats->rtt_min) stats->rtt_min = rtt;
+}
+
+/*
+ * Fit a line through the samples whose round trip is close to the lowest,
+ * the others were held up on the way and their offsets are skewed by it.
+ * With too short a window for the slope to mean anything, the clocks are
+ * taken to run at the same rate.
+ * */
+static void clockUpdate(struct ClockSync* clock) {
+    uint32_t rtt_min = UINT32_MAX;
+    for (size_t i = 0; i < clock->samples_size; i++) {
+        if (clock->samples[i].rtt < rtt_min) rtt_min = clock->samples[i].rtt;
+    }
+    uint32_t rtt_max = rtt_min + rtt_min/2 + 2;
+
+    // Relative to the newest sample, so the times stay small
+    uint32_t newest = clock->samples[(clock->samples_i + CLOCK_SAMPLES_SIZE - 1) % CLOCK_SAMPLES_SIZE].local;
+
+    double n = 0, sum_t = 0, sum_o = 0, sum_tt = 0, sum_to = 0;
+    int32_t first = 0, last = 0;
+    for (size_t i = 0; i < clock->samples_size; i++) {
+        struct ClockSample* sample = &clock->samples[i];
+        if (sample->rtt > rtt_max) continue;
+
+        int32_t t = (int32_t)(sample->local - newest);
+        if (n == 0 || t < first) first = t;
+        if (n == 0 || t > last) last = t;
+
+        n++;
+        sum_t += t;
+        sum_o += sample->offset;
+        sum_tt += (double)t*t;
+        sum_to += (double)t*sample->offset;
+    }
+
+    double mean_t = sum_t / n;
+    double mean_o = sum_o / n;
+    double skew = 0;
+    if (last - first >= 2*PING_INTERVAL) {
+        skew = (sum_to - n*mean_t*mean_o) / (sum_tt - n*mean_t*mean_t);
+        // Real clocks are nowhere near this far apart, it's noise
+        if (skew > 0.001) skew = 0.001;
+        if (skew < -0.001) skew = -0.001;
+    }
+
+    clock->synced = true;
+    clock->local_ref = newest + (int32_t)mean_t;
+    clock->offset = (int32_t)(mean_o >= 0 ? mean_o + 0.5 : mean_o - 0.5);
+    clock->skew_ppm = (int32_t)(skew * 1000000);
+    clock->error = rtt_min / 2;
+}
+
+// remote_time is when the other end answered, sent_at and now are local
+static void clockSample(struct ClockSync* clock, uint32_t sent_at, uint32_t remote_time, uint32_t now) {
+    uint32_t rtt = now - sent_at;
+
+    struct ClockSample* sample = &clock->samples[clock->samples_i];
+    sample->local = now;
+    sample->rtt = rtt;
+    // Assume the ping took as long to get there as the pong to come back
+    sample->offset = (int32_t)(remote_time - (sent_at + rtt/2));
+
+    clock->samples_i = (clock->samples_i + 1) % CLOCK_SAMPLES_SIZE;
+    if (clock->samples_size < CLOCK_SAMPLES_SIZE) clock->samples_size++;
+
+    clockUpdate(clock);
+}
+
+uint32_t connRemoteTime(struct Conn* conn, uint32_t now) {
+    struct ClockSync* clock = &conn->clock;
+    if (!clock->synced) return now;
+
+    int32_t elapsed = (int32_t)(now - clock->local_ref);
+    return now + clock->offset + (int32_t)((int64_t)elapsed * clock->skew_ppm / 1000000);
+}
+
+/*
+ * Parse the next complete message out of the receive buffer without copying
+ * it. Returns false when only a partial message (or nothing) is left.
+ *
+ * Pings are answered here and pongs turned into RTT and clock samples.
+ * */
+bool connNextMsg(struct Conn* conn, struct Msg* msg) {
+    while (true) {
+        if (!conn->open) return false;
+
+        size_t available = conn->recv_end - conn->recv_start;
+        if (available < MSG_HEADER_SIZE) return false;
+
+        uint8_t* header = &conn->recv_buff[conn->recv_start];
+
+        size_t data_size = readU32(header + 2);
+        if (MSG_HEADER_SIZE + data_size > RECV_BUFF_SIZE) {
+            fprintf(stderr, "Message too big: %zu bytes\n", data_size);
+            connClose(conn);
+            return false;
+        }
+
+        if (available < MSG_HEADER_SIZE + data_size) return false;
+
+        msg->type = (enum MsgType)readU16(header);
+        msg->data = header + MSG_HEADER_SIZE;
+        msg->size = data_size;
+
+        conn->recv_start += MSG_HEADER_SIZE + data_size;
+        conn->stats.msgs_in++;
+
+        if (conn->relay) return true;
+
+        switch (msg->type) {
+        case MSG_PING: {
+            if (msg->size == 4) {
+                uint8_t data[8];
+                memcpy(data, msg->data, 4);
+                writeU32(data + 4, conn->recv_time);
+                connSend(conn, MSG_PONG, data, sizeof(data));
+            }
+        } break;
+        case MSG_PONG: {
+            if (msg->size == 8) {
+                uint32_t sent_at = readU32(msg->data);
+                rttSample(&conn->stats, conn->recv_time - sent_at);
+                clockSample(&conn->clock, sent_at, readU32(msg->data + 4), conn->recv_time);
+            }
+        } break;
+        default: {
+            return true;
+        } break;
+        }
+    }
+}
+
+// Everything written to the connection that the socket hasn't taken yet
+size_t connQueuedBytes(struct Conn* conn) {
+    size_t bytes = conn->send_size;
+    if (conn->sending) bytes += conn->sending->size - conn->sending_off;
+    if (conn->pending) bytes += conn->pending->size;
+
+    return bytes;
+}
+
+// How long what's unsent will take to get through at the rate the other end
+// has been taking it, UINT32_MAX if it hasn't taken anything
+uint32_t connQueueDelay(struct Conn* conn) {
+    struct ConnStats* stats = &conn->stats;
+    if (stats->unsent == 0) return 0;
+    if (stats->delivered_rate == 0) return UINT32_MAX;
+
+    uint64_t delay = (uint64_t)stats->unsent * 1000 / stats->delivered_rate;
+    return delay < UINT32_MAX ? delay : UINT32_MAX;
+}
+
+void connStatsFormat(struct Conn* conn, char* buff, size_t buff_size) {
+    struct ConnStats* stats = &conn->stats;
+
+    snprintf(buff, buff_size,
+        "rtt %"PRIu32"ms in %.1fkB/s %"PRIu32"/s out %.1fkB/s %"PRIu32"/s queue %zuB skip %"PRIu64" drop %"PRIu64,
+        stats->rtt,
+        stats->bytes_in_rate / 1000.0, stats->msgs_in_rate,
+        stats->bytes_out_rate / 1000.0, stats->msgs_out_rate,
+        connQueuedBytes(conn),
+        stats->snapshots_skipped,
+        stats->snapshots_dropped
+    );
+}
+
+void connStatsPrint(struct Conn* conn, char* name, FILE* file) {
+    struct ConnStats* stats = &conn->stats;
+
+    fprintf(file, "%s:\n", name);
+    fprintf(file, "    rtt:               %"PRIu32" ms (min %"PRIu32" ms)\n", stats->rtt, stats->rtt_min);
+    fprintf(file, "    bytes in/out:      %"PRIu64" / %"PRIu64"\n", stats->bytes_in, stats->bytes_out);
+    fprintf(file, "    messages in/out:   %"PRIu64" / %"PRIu64"\n", stats->msgs_in, stats->msgs_out);
+    fprintf(file, "    snapshots skipped: %"PRIu64"\n", stats->snapshots_skipped);
+    fprintf(file, "    snapshots dropped: %"PRIu64"\n", stats->snapshots_dropped);
+    fprintf(file, "    queued:            %zu bytes\n", connQueuedBytes(conn));
+    fprintf(file, "    delivered:         %"PRIu32" B/s, %"PRIu32" bytes unsent\n", stats->delivered_rate, stats->unsent);
+}
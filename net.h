@@ -0,0 +1,257 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+#if defined(_WIN64) || defined(_WIN32)
+#define WINDOWS
+#endif
+
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#elif defined(WINDOWS)
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+// Bytes of reliable messages a connection may have queued before it is
+// considered dead. Snapshots are shared and don't count.
+#define SEND_QUEUE_SIZE (16*1024)
+// Also the largest message that can be received
+#define RECV_BUFF_SIZE (64*1024)
+// How long a connection may go without taking a new snapshot before it is dropped
+#define CONN_STALL_TIMEOUT 3000
+#define PING_INTERVAL 500
+// Pings go this often until the clock has CLOCK_SAMPLES_MIN samples
+#define PING_FAST_INTERVAL 100
+#define CLOCK_SAMPLES_MIN 4
+#define CLOCK_SAMPLES_SIZE 16
+// Rates are recomputed this often
+#define STATS_PERIOD 1000
+
+/*
+ * Every message on the wire is a header followed by `size` bytes of payload.
+ * The header is type (u16) and size (u32), in network byte order.
+ * */
+#define MSG_HEADER_SIZE 6
+
+enum MsgType {
+    MSG_JOIN,
+    // Back in after losing the connection, see proto.h
+    MSG_RESUME,
+    MSG_WELCOME,
+    MSG_LOBBY_UPDATE,
+    MSG_START_GAME,
+    MSG_INPUT,
+    MSG_STATE,
+    // How long the host's ticks take, see proto.h
+    MSG_TICK_STATS,
+    // Handled inside connNextMsg, never returned. A ping is the sender's time
+    // (u32), the pong echoes it followed by the time it was answered (u32).
+    MSG_PING,
+    MSG_PONG,
+};
+
+struct Msg {
+    enum MsgType type;
+    // Points into the connection's receive buffer, valid until the next connRecv
+    uint8_t* data;
+    size_t size;
+};
+
+/*
+ * A message encoded once and written to any number of connections. Each
+ * connection holding it has a reference, the last one to let go frees it.
+ * */
+struct SharedBuf {
+    int refs;
+    size_t size;
+    uint8_t data[];
+};
+
+struct ConnStats {
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t msgs_in;
+    uint64_t msgs_out;
+
+    // Per second, over the last STATS_PERIOD
+    uint32_t bytes_in_rate;
+    uint32_t bytes_out_rate;
+    uint32_t msgs_in_rate;
+    uint32_t msgs_out_rate;
+
+    uint32_t period_start;
+    uint64_t period_bytes_in;
+    uint64_t period_bytes_out;
+    uint64_t period_msgs_in;
+    uint64_t period_msgs_out;
+
+    // Bytes per second the other end took over the last STATS_PERIOD: what
+    // was written to the socket, less what piled up unacknowledged in it
+    uint32_t delivered_rate;
+    // Not delivered yet at the end of the period, queued here or in the socket
+    uint32_t unsent;
+    uint32_t period_kernel_unsent;
+
+    // Smoothed and lowest seen, in ms
+    uint32_t rtt;
+    uint32_t rtt_min;
+    bool has_rtt;
+
+    // Superseded before they were written, on the sending side
+    uint64_t snapshots_dropped;
+    // Received but never used because a newer one came with them
+    uint64_t snapshots_skipped;
+};
+
+struct ClockSample {
+    // When the pong came, local time
+    uint32_t local;
+    // Remote minus local time
+    int32_t offset;
+    uint32_t rtt;
+};
+
+/*
+ * The other end's clock, estimated NTP style from pings. Each pong gives the
+ * offset between the two clocks, wrong by at most half its round trip, so
+ * only the samples with the lowest round trips are trusted. A line fitted
+ * through them gives the offset at local_ref and the skew, how many
+ * milliseconds per million the other clock runs ahead.
+ * */
+struct ClockSync {
+    // Ring buffer, the last CLOCK_SAMPLES_SIZE pongs
+    struct ClockSample samples[CLOCK_SAMPLES_SIZE];
+    size_t samples_size;
+    size_t samples_i;
+
+    bool synced;
+    int32_t offset;
+    uint32_t local_ref;
+    int32_t skew_ppm;
+    // Half the lowest round trip, how far off offset may be
+    uint32_t error;
+};
+
+/*
+ * A backend that does a connection's I/O instead of its socket, like the
+ * server's io_uring one, shared memory or the game's network thread. The
+ * connection hands it what to send instead of calling send. What's received
+ * is read from it by connRecv, or without read, passed on by the backend
+ * with connFeed.
+ * */
+struct ConnIo {
+    // Takes up to data_size bytes, returns how many, 0 when it's full and -1
+    // once the connection is broken
+    int (*write)(void* ctx, uint8_t* data, size_t data_size);
+    // The same the other way, 0 when there's nothing to read
+    int (*read)(void* ctx, uint8_t* buff, size_t buff_size);
+    // The connection is being closed, nothing may be fed to it anymore
+    void (*close)(void* ctx);
+    // Bytes taken but not delivered yet, NULL to ask the socket
+    uint32_t (*unsent)(void* ctx);
+};
+
+/*
+ * Outbound side of a connection. Sends never block: what the socket doesn't
+ * take is kept in send_queue and retried on the next connFlush.
+ *
+ * Snapshots are not queued behind each other. While one is still being
+ * written from `sending`, newer ones replace each other in pending, so a slow
+ * client always gets the latest state instead of a backlog.
+ * */
+struct Conn {
+    // -1 when only the backend has it
+    int fd;
+    bool open;
+    // Pings are passed through instead of being sent and answered, for proxies
+    bool relay;
+    // Most bytes one connRecv takes from the socket, 0 for as many as fit
+    size_t recv_chunk;
+    // NULL when the connection uses its socket itself
+    const struct ConnIo* io;
+    void* io_ctx;
+
+    // Ring buffer
+    uint8_t send_queue[SEND_QUEUE_SIZE];
+    size_t send_head;
+    size_t send_size;
+
+    struct SharedBuf* pending;
+    struct SharedBuf* sending;
+    size_t sending_off;
+
+    uint32_t stall_start;
+
+    // Inbound bytes, messages are parsed in place from recv_start
+    uint8_t recv_buff[RECV_BUFF_SIZE];
+    size_t recv_start;
+    size_t recv_end;
+    uint32_t recv_time;
+
+    uint32_t last_ping;
+    struct ConnStats stats;
+    struct ClockSync clock;
+};
+
+// Socket calls made by connections, for comparing ways of doing I/O
+extern uint64_t net_syscalls;
+
+void errnoAbort(char* message);
+int pcr(int ret, char* message);
+void* pcp(void* p, char* message);
+
+// Payload fields are in network byte order
+void writeU16(uint8_t* p, uint16_t x);
+void writeU32(uint8_t* p, uint32_t x);
+uint16_t readU16(uint8_t* p);
+uint32_t readU32(uint8_t* p);
+
+// Milliseconds from an arbitrary start, for programs without SDL
+uint32_t netNow();
+// For timing short work
+uint64_t netNowUs();
+
+void unblock(int fd);
+void closeFd(int fd);
+uint32_t netKernelUnsent(int fd);
+
+int netConnectStart(struct sockaddr_in* addr, int rcvbuf);
+int netConnectPoll(int fd);
+
+struct SharedBuf* sharedBufNew(enum MsgType type, void* data, size_t data_size);
+struct SharedBuf* sharedBufRef(struct SharedBuf* buf);
+void sharedBufUnref(struct SharedBuf* buf);
+
+void connInit(struct Conn* conn, int fd);
+void connClose(struct Conn* conn);
+bool connSend(struct Conn* conn, enum MsgType type, void* data, size_t data_size);
+void connSendSnapshot(struct Conn* conn, struct SharedBuf* buf, uint32_t now);
+bool connFlush(struct Conn* conn, uint32_t now);
+bool connRecv(struct Conn* conn, uint32_t now);
+bool connNextMsg(struct Conn* conn, struct Msg* msg);
+
+void connSetIo(struct Conn* conn, const struct ConnIo* io, void* ctx);
+bool connFeed(struct Conn* conn, uint8_t* data, size_t data_size);
+
+// The other end's clock at local time now, now itself until synced
+uint32_t connRemoteTime(struct Conn* conn, uint32_t now);
+
+size_t connQueuedBytes(struct Conn* conn);
+uint32_t connQueueDelay(struct Conn* conn);
+void connStatsFormat(struct Conn* conn, char* buff, size_t buff_size);
+void connStatsPrint(struct Conn* conn, char* name, FILE* file);
+
+#endif // NET_H
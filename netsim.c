@@ -0,0 +1,427 @@
+/*
+ * netsim: a proxy between a host and its clients that makes the link worse on
+ * purpose, so online play can be tested on one machine.
+ *
+ * Clients connect to netsim instead of the host. Every message is held back
+ * by the simulated latency, jitter and bandwidth before it's passed on.
+ * Messages that are "lost" are dropped if the protocol can live without
+ * them (states, inputs, pings), otherwise delayed by a retransmit timeout
+ * like TCP would. Droppable messages may also be reordered.
+ * */
+#if defined(__linux__)
+// select
+#define _POSIX_C_SOURCE 200809L
+#include <sys/select.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "net.h"
+
+#define MAX_LINKS 64
+#define DELAYED_SIZE 4096
+// How long a reordered message is held back at most
+#define REORDER_HOLD 50
+// How far behind a bandwidth limited link gets before it stops reading, like
+// a router's buffer. The sender's socket fills up after that.
+#define LINK_BUFFER 200
+#define LINK_RCVBUF (4*1024)
+#define MIN_RECV_CHUNK 256
+// How long a link waits for the host to take its connection
+#define LINK_CONNECT_TIMEOUT 5000
+
+struct Impairment {
+    uint32_t latency;
+    uint32_t jitter;
+    // Bytes per second, 0 is unlimited
+    uint32_t bandwidth;
+    // Percent
+    int loss;
+    int reorder;
+    uint32_t rto;
+} impairment = {
+    .rto = 200,
+};
+
+struct Delayed {
+    uint32_t due;
+    enum MsgType type;
+    uint8_t* data;
+    size_t size;
+};
+
+// One direction of a link
+struct Pipe {
+    struct Conn* from;
+    struct Conn* to;
+
+    // Sorted by due
+    struct Delayed queue[DELAYED_SIZE];
+    size_t queue_size;
+
+    // When the simulated link is done with what was sent so far
+    uint32_t link_free;
+    // Reliable messages never overtake each other
+    uint32_t last_due;
+
+    uint64_t relayed;
+    uint64_t dropped;
+    uint64_t retransmitted;
+    uint64_t reordered;
+};
+
+struct Link {
+    struct Conn client;
+    struct Conn host;
+    // Nothing is relayed until the host took the connection, meanwhile
+    // the other links go on
+    bool connecting;
+    uint32_t connect_start;
+
+    // client to host
+    struct Pipe up;
+    // host to client
+    struct Pipe down;
+};
+
+struct Link* links[MAX_LINKS];
+
+bool droppable(enum MsgType type) {
+    return type == MSG_STATE || type == MSG_INPUT || type == MSG_TICK_STATS || type == MSG_PING || type == MSG_PONG;
+}
+
+bool chance(int percent) {
+    return rand() % 100 < percent;
+}
+
+bool pipeBackedUp(struct Pipe* pipe, uint32_t now) {
+    return (int32_t)(pipe->link_free - now) > LINK_BUFFER;
+}
+
+bool pipeSchedule(struct Pipe* pipe, struct Msg* msg, uint32_t now) {
+    if (pipe->queue_size == DELAYED_SIZE) {
+        fprintf(stderr, "Too many delayed messages\n");
+        return false;
+    }
+
+    uint32_t start = pipe->link_free > now ? pipe->link_free : now;
+    uint32_t transmit = 0;
+    if (impairment.bandwidth) {
+        transmit = (MSG_HEADER_SIZE + msg->size) * 1000 / impairment.bandwidth;
+    }
+    pipe->link_free = start + transmit;
+
+    uint32_t due = pipe->link_free + impairment.latency;
+    if (impairment.jitter) {
+        due += rand() % (impairment.jitter + 1);
+    }
+
+    if (chance(impairment.loss)) {
+        if (droppable(msg->type)) {
+            pipe->dropped++;
+            return true;
+        }
+        due += impairment.rto;
+        pipe->retransmitted++;
+    }
+
+    if (droppable(msg->type) && chance(impairment.reorder)) {
+        // Held back without holding anything else back
+        due += 1 + rand() % REORDER_HOLD;
+        pipe->reordered++;
+    } else {
+        if (due < pipe->last_due) due = pipe->last_due;
+        pipe->last_due = due;
+    }
+
+    struct Delayed delayed = {
+        .due = due,
+        .type = msg->type,
+        .data = pcp(malloc(msg->size + 1), "malloc failed"),
+        .size = msg->size,
+    };
+    memcpy(delayed.data, msg->data, msg->size);
+
+    // Insert after everything due at the same time
+    size_t i = pipe->queue_size;
+    while (i > 0 && pipe->queue[i-1].due > due) {
+        pipe->queue[i] = pipe->queue[i-1];
+        i--;
+    }
+    pipe->queue[i] = delayed;
+    pipe->queue_size++;
+
+    return true;
+}
+
+void pipeDeliver(struct Pipe* pipe, uint32_t now) {
+    size_t delivered = 0;
+
+    while (delivered < pipe->queue_size && pipe->queue[delivered].due <= now) {
+        struct Delayed* delayed = &pipe->queue[delivered];
+
+        if (delayed->type == MSG_STATE) {
+            struct SharedBuf* buf = sharedBufNew(delayed->type, delayed->data, delayed->size);
+            connSendSnapshot(pipe->to, buf, now);
+            sharedBufUnref(buf);
+        } else {
+            connSend(pipe->to, delayed->type, delayed->data, delayed->size);
+        }
+
+        free(delayed->data);
+        pipe->relayed++;
+        delivered++;
+    }
+
+    pipe->queue_size -= delivered;
+    memmove(pipe->queue, &pipe->queue[delivered], pipe->queue_size*sizeof(struct Delayed));
+}
+
+// Returns false once either side is gone
+bool pipePump(struct Pipe* pipe, uint32_t now) {
+    if (!pipeBackedUp(pipe, now) && !connRecv(pipe->from, now)) return false;
+
+    struct Msg msg;
+    while (connNextMsg(pipe->from, &msg)) {
+        if (!pipeSchedule(pipe, &msg, now)) return false;
+    }
+
+    pipeDeliver(pipe, now);
+
+    return connFlush(pipe->to, now);
+}
+
+void pipeInit(struct Pipe* pipe, struct Conn* from, struct Conn* to) {
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->from = from;
+    pipe->to = to;
+}
+
+void pipePrint(struct Pipe* pipe, char* name) {
+    printf("    %s: %"PRIu64" relayed, %"PRIu64" dropped, %"PRIu64" retransmitted, %"PRIu64" reordered\n",
+        name, pipe->relayed, pipe->dropped, pipe->retransmitted, pipe->reordered);
+}
+
+void linkClose(size_t link_i) {
+    struct Link* link = links[link_i];
+
+    // Never opened otherwise
+    if (!link->connecting) {
+        printf("Link %zu closed\n", link_i);
+        pipePrint(&link->up, "client to host");
+        pipePrint(&link->down, "host to client");
+    }
+
+    for (size_t i = 0; i < link->up.queue_size; i++) free(link->up.queue[i].data);
+    for (size_t i = 0; i < link->down.queue_size; i++) free(link->down.queue[i].data);
+
+    connClose(&link->client);
+    connClose(&link->host);
+
+    free(link);
+    links[link_i] = NULL;
+}
+
+void linkOpen(int client_fd, struct sockaddr_in* host_addr) {
+    size_t link_i = 0;
+    while (link_i < MAX_LINKS && links[link_i]) link_i++;
+
+    if (link_i == MAX_LINKS) {
+        fprintf(stderr, "Too many links\n");
+        closeFd(client_fd);
+        return;
+    }
+
+    // A small window, so a link that stopped reading backs the host up soon
+    // instead of after a loopback-sized buffer
+    int host_fd = netConnectStart(host_addr, LINK_RCVBUF);
+    if (host_fd < 0) {
+        perror("Connection to host failed");
+        closeFd(client_fd);
+        return;
+    }
+
+    unblock(client_fd);
+
+    struct Link* link = pcp(calloc(1, sizeof(*link)), "calloc failed");
+    connInit(&link->client, client_fd);
+    connInit(&link->host, host_fd);
+    link->connecting = true;
+    link->connect_start = netNow();
+    link->client.relay = true;
+    link->host.relay = true;
+    // Read about as fast as the link goes, so what it can't take waits in
+    // the sender's socket
+    if (impairment.bandwidth) {
+        size_t chunk = impairment.bandwidth / 100;
+        if (chunk < MIN_RECV_CHUNK) chunk = MIN_RECV_CHUNK;
+        link->client.recv_chunk = chunk;
+        link->host.recv_chunk = chunk;
+    }
+
+    pipeInit(&link->up, &link->client, &link->host);
+    pipeInit(&link->down, &link->host, &link->client);
+
+    links[link_i] = link;
+}
+
+// Returns false if the host didn't take the connection
+bool linkConnect(size_t link_i, uint32_t now) {
+    struct Link* link = links[link_i];
+
+    int connected = netConnectPoll(link->host.fd);
+    if (connected == 0 && now - link->connect_start < LINK_CONNECT_TIMEOUT) return true;
+
+    if (connected <= 0) {
+        fprintf(stderr, "Connection to host failed\n");
+        return false;
+    }
+
+    link->connecting = false;
+    printf("Link %zu open\n", link_i);
+    return true;
+}
+
+void usage(char* program) {
+    fprintf(stderr,
+        "usage: %s LISTEN_PORT HOST_IP HOST_PORT [options]\n"
+        "\n"
+        "Applied to each direction separately:\n"
+        "    --latency MS     one-way delay\n"
+        "    --jitter MS      extra random delay, up to MS\n"
+        "    --bandwidth KBPS link capacity in kilobytes per second\n"
+        "    --loss PERCENT   chance a message is lost\n"
+        "    --reorder PERCENT chance a droppable message is overtaken\n"
+        "    --rto MS         delay of a lost message that can't be dropped (default 200)\n"
+        "    --seed N\n",
+        program
+    );
+    exit(EXIT_FAILURE);
+}
+
+uint32_t parseNum(char* program, char* str, uint32_t max) {
+    char* end;
+    long num = strtol(str, &end, 10);
+
+    if (*str == '\0' || *end != '\0' || num < 0 || (unsigned long)num > max) {
+        fprintf(stderr, "Invalid number: %s\n", str);
+        usage(program);
+    }
+
+    return num;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) usage(argv[0]);
+
+    uint16_t listen_port = parseNum(argv[0], argv[1], UINT16_MAX);
+
+    struct sockaddr_in host_addr;
+    memset(&host_addr, 0, sizeof(host_addr));
+    host_addr.sin_family = AF_INET;
+    host_addr.sin_port = htons(parseNum(argv[0], argv[3], UINT16_MAX));
+    if (inet_pton(AF_INET, argv[2], &host_addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IP: %s\n", argv[2]);
+        usage(argv[0]);
+    }
+
+    unsigned seed = netNow();
+
+    for (int i = 4; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+
+        char* opt = argv[i];
+        char* value = argv[++i];
+
+        if (strcmp(opt, "--latency") == 0) {
+            impairment.latency = parseNum(argv[0], value, 60000);
+        } else if (strcmp(opt, "--jitter") == 0) {
+            impairment.jitter = parseNum(argv[0], value, 60000);
+        } else if (strcmp(opt, "--bandwidth") == 0) {
+            impairment.bandwidth = parseNum(argv[0], value, 1000000) * 1000;
+        } else if (strcmp(opt, "--loss") == 0) {
+            impairment.loss = parseNum(argv[0], value, 100);
+        } else if (strcmp(opt, "--reorder") == 0) {
+            impairment.reorder = parseNum(argv[0], value, 100);
+        } else if (strcmp(opt, "--rto") == 0) {
+            impairment.rto = parseNum(argv[0], value, 60000);
+        } else if (strcmp(opt, "--seed") == 0) {
+            seed = parseNum(argv[0], value, UINT32_MAX);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", opt);
+            usage(argv[0]);
+        }
+    }
+
+    srand(seed);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+#ifdef WINDOWS
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != NO_ERROR) {
+        fprintf(stderr, "WSAStartup failed: %d\n", WSAGetLastError());
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    pcr(listen_fd, "Socket creation failed");
+
+    struct sockaddr_in listen_addr;
+    memset(&listen_addr, 0, sizeof(listen_addr));
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_port = htons(listen_port);
+    listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    pcr(bind(listen_fd, (struct sockaddr*)&listen_addr, sizeof(listen_addr)), "Bind failed");
+    pcr(listen(listen_fd, MAX_LINKS), "Listening failed");
+    unblock(listen_fd);
+
+    printf("Listening on %"PRIu16", forwarding to %s:%s (seed %u)\n", listen_port, argv[2], argv[3], seed);
+
+    while (true) {
+        // Wake up for new data, or at least every millisecond to deliver on time
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(listen_fd, &read_fds);
+        int max_fd = listen_fd;
+
+        uint32_t now = netNow();
+
+        for (size_t i = 0; i < MAX_LINKS; i++) {
+            if (!links[i] || links[i]->connecting) continue;
+
+            if (!pipeBackedUp(&links[i]->up, now)) FD_SET(links[i]->client.fd, &read_fds);
+            if (!pipeBackedUp(&links[i]->down, now)) FD_SET(links[i]->host.fd, &read_fds);
+            if (links[i]->client.fd > max_fd) max_fd = links[i]->client.fd;
+            if (links[i]->host.fd > max_fd) max_fd = links[i]->host.fd;
+        }
+
+        struct timeval timeout = {.tv_sec = 0, .tv_usec = 1000};
+        select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+
+        now = netNow();
+
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd >= 0) {
+            linkOpen(client_fd, &host_addr);
+        }
+
+        for (size_t i = 0; i < MAX_LINKS; i++) {
+            if (!links[i]) continue;
+
+            if (links[i]->connecting) {
+                if (!linkConnect(i, now)) linkClose(i);
+                continue;
+            }
+
+            if (!pipePump(&links[i]->up, now) || !pipePump(&links[i]->down, now)) {
+                linkClose(i);
+            }
+        }
+    }
+}
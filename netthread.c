@@ -0,0 +1,496 @@
+#include <string.h>
+
+#include "netthread.h"
+
+#if defined(__linux__)
+#include <sys/select.h>
+#include <SDL2/SDL.h>
+#elif defined(WINDOWS)
+#include <SDL.h>
+#endif
+
+enum NetCommandType {
+    NET_LISTEN,
+    NET_CONNECT,
+};
+
+struct NetCommand {
+    enum NetCommandType type;
+    int fd;
+    struct sockaddr_in addr;
+    uint32_t timeout;
+};
+
+struct NetThread {
+    SDL_Thread* thread;
+    uint32_t stop;
+    // Set while the thread sleeps, see netThreadWake
+    uint32_t waiting;
+    // Connected to itself, a datagram on it wakes the thread up
+    int wake_fd;
+
+    // From the game to the thread, and back
+    struct NetRing commands;
+    struct NetRing events;
+    struct NetChannel channels[NET_CHANNELS_SIZE];
+
+    // Only the thread's
+    int listen_fd;
+    int connect_fd;
+    uint32_t connect_deadline;
+};
+
+// Where the writer can put up to *size bytes in one piece
+static uint8_t* ringWriteSpan(struct NetRing* ring, size_t* size) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail;
+
+    size_t off = tail & (NET_RING_SIZE - 1);
+    size_t free_size = NET_RING_SIZE - (tail - head);
+    *size = NET_RING_SIZE - off < free_size ? NET_RING_SIZE - off : free_size;
+    return &ring->data[off];
+}
+
+static void ringWritten(struct NetRing* ring, size_t size) {
+    __atomic_store_n(&ring->tail, ring->tail + size, __ATOMIC_RELEASE);
+}
+
+// Where the reader can take up to *size bytes from in one piece
+static uint8_t* ringReadSpan(struct NetRing* ring, size_t* size) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = ring->head;
+
+    size_t off = head & (NET_RING_SIZE - 1);
+    size_t used = tail - head;
+    *size = NET_RING_SIZE - off < used ? NET_RING_SIZE - off : used;
+    return &ring->data[off];
+}
+
+static void ringConsumed(struct NetRing* ring, size_t size) {
+    __atomic_store_n(&ring->head, ring->head + size, __ATOMIC_RELEASE);
+}
+
+static size_t ringUsed(struct NetRing* ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+static size_t ringWrite(struct NetRing* ring, uint8_t* data, size_t data_size) {
+    size_t written = 0;
+    while (written < data_size) {
+        size_t span;
+        uint8_t* dest = ringWriteSpan(ring, &span);
+        if (span == 0) break;
+        if (span > data_size - written) span = data_size - written;
+
+        memcpy(dest, &data[written], span);
+        ringWritten(ring, span);
+        written += span;
+    }
+
+    return written;
+}
+
+static size_t ringRead(struct NetRing* ring, uint8_t* buff, size_t buff_size) {
+    size_t read = 0;
+    while (read < buff_size) {
+        size_t span;
+        uint8_t* src = ringReadSpan(ring, &span);
+        if (span == 0) break;
+        if (span > buff_size - read) span = buff_size - read;
+
+        memcpy(&buff[read], src, span);
+        ringConsumed(ring, span);
+        read += span;
+    }
+
+    return read;
+}
+
+// Commands and events go in whole or not at all
+static bool ringPush(struct NetRing* ring, void* record, size_t size) {
+    if (NET_RING_SIZE - ringUsed(ring) < size) return false;
+
+    ringWrite(ring, record, size);
+    return true;
+}
+
+static bool ringPop(struct NetRing* ring, void* record, size_t size) {
+    if (ringUsed(ring) < size) return false;
+
+    ringRead(ring, record, size);
+    return true;
+}
+
+static int channelWrite(void* ctx, uint8_t* data, size_t data_size) {
+    struct NetChannel* channel = ctx;
+    if (__atomic_load_n(&channel->state, __ATOMIC_ACQUIRE) != NET_CHANNEL_OPEN) return -1;
+
+    return ringWrite(&channel->out, data, data_size);
+}
+
+static int channelRead(void* ctx, uint8_t* buff, size_t buff_size) {
+    struct NetChannel* channel = ctx;
+
+    // Before reading, so what came before it broke isn't missed
+    uint32_t state = __atomic_load_n(&channel->state, __ATOMIC_ACQUIRE);
+    size_t size = ringRead(&channel->in, buff, buff_size);
+    if (size == 0 && state != NET_CHANNEL_OPEN) return -1;
+
+    return size;
+}
+
+static void channelClose(void* ctx) {
+    struct NetChannel* channel = ctx;
+    __atomic_store_n(&channel->state, NET_CHANNEL_CLOSED, __ATOMIC_RELEASE);
+}
+
+static uint32_t channelUnsent(void* ctx) {
+    struct NetChannel* channel = ctx;
+    return ringUsed(&channel->out) + __atomic_load_n(&channel->kernel_unsent, __ATOMIC_RELAXED);
+}
+
+static const struct ConnIo net_channel_io = {
+    .write = channelWrite,
+    .read = channelRead,
+    .close = channelClose,
+    .unsent = channelUnsent,
+};
+
+static bool netThreadWouldBlock() {
+#if defined(__linux__)
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#elif defined(WINDOWS)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#endif // defined
+}
+
+// The game only finds out on its side, unless it closed the channel first
+static void channelBroken(struct NetChannel* channel) {
+    uint32_t open = NET_CHANNEL_OPEN;
+    __atomic_compare_exchange_n(&channel->state, &open, NET_CHANNEL_BROKEN, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// Returns SIZE_MAX if all channels are taken
+static size_t channelOpen(struct NetThread* thread, int fd) {
+    for (size_t i = 0; i < NET_CHANNELS_SIZE; i++) {
+        struct NetChannel* channel = &thread->channels[i];
+        if (__atomic_load_n(&channel->state, __ATOMIC_ACQUIRE) != NET_CHANNEL_FREE) continue;
+
+        channel->fd = fd;
+        channel->in.head = channel->in.tail = 0;
+        channel->out.head = channel->out.tail = 0;
+        channel->kernel_unsent = 0;
+        // Published with the event that hands it to the game
+        __atomic_store_n(&channel->state, NET_CHANNEL_OPEN, __ATOMIC_RELAXED);
+        return i;
+    }
+
+    return SIZE_MAX;
+}
+
+static void channelFree(struct NetChannel* channel) {
+    closeFd(channel->fd);
+    channel->fd = -1;
+    __atomic_store_n(&channel->state, NET_CHANNEL_FREE, __ATOMIC_RELEASE);
+}
+
+// The socket goes with the event, closed if the game can't be told
+static void netThreadEvent(struct NetThread* thread, enum NetEventType type, int fd) {
+    struct NetEvent event = {.type = type, .channel = SIZE_MAX, .fd = fd};
+
+    if (fd >= 0) {
+        event.channel = channelOpen(thread, fd);
+        if (event.channel == SIZE_MAX) {
+            fprintf(stderr, "No channel left for a connection\n");
+            closeFd(fd);
+            if (type == NET_ACCEPTED) return;
+
+            event.type = NET_CONNECT_FAILED;
+            event.fd = -1;
+        }
+    }
+
+    if (!ringPush(&thread->events, &event, sizeof(event)) && event.channel != SIZE_MAX) {
+        channelFree(&thread->channels[event.channel]);
+    }
+}
+
+static void netThreadCommands(struct NetThread* thread) {
+    struct NetCommand command;
+    while (ringPop(&thread->commands, &command, sizeof(command))) {
+        switch (command.type) {
+        case NET_LISTEN: {
+            thread->listen_fd = command.fd;
+        } break;
+        case NET_CONNECT: {
+            // Only the last attempt is of any use
+            if (thread->connect_fd >= 0) closeFd(thread->connect_fd);
+
+            thread->connect_fd = netConnectStart(&command.addr, 0);
+            thread->connect_deadline = netNow() + command.timeout;
+            if (thread->connect_fd < 0) netThreadEvent(thread, NET_CONNECT_FAILED, -1);
+        } break;
+        }
+    }
+}
+
+static void netThreadAccept(struct NetThread* thread) {
+    while (true) {
+        int fd = accept(thread->listen_fd, NULL, NULL);
+        if (fd < 0) return;
+
+        unblock(fd);
+        netThreadEvent(thread, NET_ACCEPTED, fd);
+    }
+}
+
+static void netThreadConnectPoll(struct NetThread* thread, bool ready) {
+    int connected = ready ? netConnectPoll(thread->connect_fd) : 0;
+    if (connected == 0 && (int32_t)(netNow() - thread->connect_deadline) < 0) return;
+
+    if (connected > 0) {
+        netThreadEvent(thread, NET_CONNECTED, thread->connect_fd);
+    } else {
+        closeFd(thread->connect_fd);
+        netThreadEvent(thread, NET_CONNECT_FAILED, -1);
+    }
+    thread->connect_fd = -1;
+}
+
+static void channelRecv(struct NetChannel* channel) {
+    while (true) {
+        size_t span;
+        uint8_t* dest = ringWriteSpan(&channel->in, &span);
+        if (span == 0) return;
+
+#ifdef __linux__
+        ssize_t bytes = recv(channel->fd, dest, span, 0);
+#elif defined(WINDOWS)
+        int bytes = recv(channel->fd, (char*)dest, span, 0);
+#endif // defined
+
+        if (bytes < 0 && netThreadWouldBlock()) return;
+        if (bytes <= 0) {
+            channelBroken(channel);
+            return;
+        }
+
+        ringWritten(&channel->in, bytes);
+    }
+}
+
+static void channelSend(struct NetChannel* channel) {
+    while (true) {
+        size_t span;
+        uint8_t* src = ringReadSpan(&channel->out, &span);
+        if (span == 0) return;
+
+#ifdef __linux__
+        ssize_t bytes = send(channel->fd, src, span, MSG_NOSIGNAL);
+#elif defined(WINDOWS)
+        int bytes = send(channel->fd, (char*)src, span, 0);
+#endif // defined
+
+        if (bytes < 0) {
+            if (!netThreadWouldBlock()) channelBroken(channel);
+            return;
+        }
+
+        ringConsumed(&channel->out, bytes);
+    }
+}
+
+/*
+ * Sleeps in select until a socket is ready or the game wakes it up. Rings
+ * the game filled while the thread was busy are seen before it goes to
+ * sleep, since waiting is set first.
+ * */
+static int netThreadRun(void* data) {
+    struct NetThread* thread = data;
+
+    while (!__atomic_load_n(&thread->stop, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&thread->waiting, 1, __ATOMIC_RELAXED);
+        // Against the game's writes to the rings before it checks waiting
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        netThreadCommands(thread);
+
+        fd_set read_fds;
+        fd_set write_fds;
+        fd_set except_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_ZERO(&except_fds);
+
+        int max_fd = thread->wake_fd;
+        FD_SET(thread->wake_fd, &read_fds);
+
+        if (thread->listen_fd >= 0) {
+            FD_SET(thread->listen_fd, &read_fds);
+            if (thread->listen_fd > max_fd) max_fd = thread->listen_fd;
+        }
+
+        uint32_t sleep_ms = NET_THREAD_SLEEP;
+        if (thread->connect_fd >= 0) {
+            FD_SET(thread->connect_fd, &write_fds);
+            FD_SET(thread->connect_fd, &except_fds);
+            if (thread->connect_fd > max_fd) max_fd = thread->connect_fd;
+
+            int32_t left = thread->connect_deadline - netNow();
+            if (left < (int32_t)sleep_ms) sleep_ms = left > 0 ? left : 0;
+        }
+
+        for (size_t i = 0; i < NET_CHANNELS_SIZE; i++) {
+            struct NetChannel* channel = &thread->channels[i];
+
+            uint32_t state = __atomic_load_n(&channel->state, __ATOMIC_ACQUIRE);
+            if (state == NET_CHANNEL_CLOSED) channelFree(channel);
+            if (state != NET_CHANNEL_OPEN) continue;
+
+            if (ringUsed(&channel->in) < NET_RING_SIZE) FD_SET(channel->fd, &read_fds);
+            if (ringUsed(&channel->out) > 0) FD_SET(channel->fd, &write_fds);
+            if (channel->fd > max_fd) max_fd = channel->fd;
+        }
+
+        struct timeval timeout = {.tv_sec = sleep_ms / 1000, .tv_usec = sleep_ms % 1000 * 1000};
+        int ready = select(max_fd + 1, &read_fds, &write_fds, &except_fds, &timeout);
+        __atomic_store_n(&thread->waiting, 0, __ATOMIC_RELAXED);
+        if (ready < 0) continue;
+
+        if (FD_ISSET(thread->wake_fd, &read_fds)) {
+            char buff[64];
+            while (recv(thread->wake_fd, buff, sizeof(buff), 0) > 0) {}
+        }
+
+        if (thread->listen_fd >= 0 && FD_ISSET(thread->listen_fd, &read_fds)) {
+            netThreadAccept(thread);
+        }
+
+        if (thread->connect_fd >= 0) {
+            netThreadConnectPoll(thread, FD_ISSET(thread->connect_fd, &write_fds) || FD_ISSET(thread->connect_fd, &except_fds));
+        }
+
+        for (size_t i = 0; i < NET_CHANNELS_SIZE; i++) {
+            struct NetChannel* channel = &thread->channels[i];
+            if (__atomic_load_n(&channel->state, __ATOMIC_ACQUIRE) != NET_CHANNEL_OPEN) continue;
+
+            if (FD_ISSET(channel->fd, &read_fds)) channelRecv(channel);
+
+            bool sent = FD_ISSET(channel->fd, &write_fds);
+            if (sent) channelSend(channel);
+
+            // Until it's all gone, for the game's delivered rate
+            if (sent || channel->kernel_unsent > 0) {
+                __atomic_store_n(&channel->kernel_unsent, netKernelUnsent(channel->fd), __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int wakeSocket() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+            || getsockname(fd, (struct sockaddr*)&addr, &len) < 0
+            || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        closeFd(fd);
+        return -1;
+    }
+
+    unblock(fd);
+    return fd;
+}
+
+// NULL if it couldn't be started
+struct NetThread* netThreadStart() {
+    int wake_fd = wakeSocket();
+    if (wake_fd < 0) return NULL;
+
+    struct NetThread* thread = pcp(calloc(1, sizeof(*thread)), "calloc failed");
+    thread->wake_fd = wake_fd;
+    thread->listen_fd = -1;
+    thread->connect_fd = -1;
+    for (size_t i = 0; i < NET_CHANNELS_SIZE; i++) {
+        thread->channels[i].fd = -1;
+    }
+
+    thread->thread = SDL_CreateThread(netThreadRun, "net", thread);
+    if (!thread->thread) {
+        fprintf(stderr, "Couldn't start the network thread: %s\n", SDL_GetError());
+        closeFd(wake_fd);
+        free(thread);
+        return NULL;
+    }
+
+    return thread;
+}
+
+// Closes every socket it has, connections attached to it must not be used after
+void netThreadStop(struct NetThread* thread) {
+    __atomic_store_n(&thread->stop, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&thread->waiting, 1, __ATOMIC_RELAXED);
+    netThreadWake(thread);
+    SDL_WaitThread(thread->thread, NULL);
+
+    for (size_t i = 0; i < NET_CHANNELS_SIZE; i++) {
+        if (thread->channels[i].fd >= 0) closeFd(thread->channels[i].fd);
+    }
+    if (thread->listen_fd >= 0) closeFd(thread->listen_fd);
+    if (thread->connect_fd >= 0) closeFd(thread->connect_fd);
+    closeFd(thread->wake_fd);
+    free(thread);
+}
+
+static void netThreadCommand(struct NetThread* thread, struct NetCommand* command) {
+    if (!ringPush(&thread->commands, command, sizeof(*command))) {
+        fprintf(stderr, "Network thread isn't keeping up\n");
+        return;
+    }
+    netThreadWake(thread);
+}
+
+void netThreadListen(struct NetThread* thread, int fd) {
+    struct NetCommand command = {.type = NET_LISTEN, .fd = fd};
+    netThreadCommand(thread, &command);
+}
+
+void netThreadConnect(struct NetThread* thread, struct sockaddr_in* addr, uint32_t timeout) {
+    struct NetCommand command = {.type = NET_CONNECT, .fd = -1, .addr = *addr, .timeout = timeout};
+    netThreadCommand(thread, &command);
+}
+
+bool netThreadNext(struct NetThread* thread, struct NetEvent* event) {
+    return ringPop(&thread->events, event, sizeof(*event));
+}
+
+/*
+ * The connection goes through the channel from now on. Its socket is the
+ * thread's, closed by it once the connection is.
+ * */
+void netThreadAttach(struct NetThread* thread, size_t channel, struct Conn* conn) {
+    conn->fd = -1;
+    connSetIo(conn, &net_channel_io, &thread->channels[channel]);
+}
+
+// For a connection the game turned away
+void netThreadDrop(struct NetThread* thread, size_t channel) {
+    channelClose(&thread->channels[channel]);
+}
+
+void netThreadWake(struct NetThread* thread) {
+    // Against the thread's store to waiting before it looks at the rings
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&thread->waiting, __ATOMIC_RELAXED)) {
+        char byte = 0;
+        send(thread->wake_fd, &byte, 1, 0);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef NETTHREAD_H
+#define NETTHREAD_H
+
+#include "net.h"
+
+// Each way per connection, and for commands and events, a power of two
+#define NET_RING_SIZE (32*1024)
+// A full room, and a few more that are turned away or about to resume
+#define NET_CHANNELS_SIZE 72
+// Longest the thread sleeps with nothing to do, so what the kernel still
+// holds for each connection is looked at again
+#define NET_THREAD_SLEEP 100
+
+/*
+ * The game's sockets, on a thread of their own so a slow network never holds
+ * up a frame.
+ *
+ * Every connection the thread accepts or makes gets a channel, a ring each
+ * way between the thread and the socket's Conn on the game's side. The game
+ * writes and reads its connections as usual, but they only fill and drain
+ * the rings, and the thread does the sends and receives. Each ring has a
+ * single writer and a single reader, so head and tail are all they share.
+ * Listening and connecting are commands, and the thread answers with events.
+ * */
+struct NetRing {
+    // Written by the reader
+    _Alignas(64) uint32_t head;
+    // Written by the writer
+    _Alignas(64) uint32_t tail;
+    _Alignas(64) uint8_t data[NET_RING_SIZE];
+};
+
+enum NetChannelState {
+    NET_CHANNEL_FREE,
+    NET_CHANNEL_OPEN,
+    // The socket failed, the game finds out once it read what came before
+    NET_CHANNEL_BROKEN,
+    // By the game, the thread closes the socket and frees the channel
+    NET_CHANNEL_CLOSED,
+};
+
+struct NetChannel {
+    struct NetRing in;
+    struct NetRing out;
+    uint32_t state;
+    int fd;
+    // Sampled by the thread after writing to the socket
+    uint32_t kernel_unsent;
+};
+
+enum NetEventType {
+    NET_ACCEPTED,
+    NET_CONNECTED,
+    NET_CONNECT_FAILED,
+};
+
+struct NetEvent {
+    enum NetEventType type;
+    // The channel and its socket, if there's one
+    size_t channel;
+    int fd;
+};
+
+struct NetThread;
+
+struct NetThread* netThreadStart();
+void netThreadStop(struct NetThread* thread);
+
+// The thread accepts on fd from now on
+void netThreadListen(struct NetThread* thread, int fd);
+// Answered with NET_CONNECTED, or NET_CONNECT_FAILED after timeout
+void netThreadConnect(struct NetThread* thread, struct sockaddr_in* addr, uint32_t timeout);
+bool netThreadNext(struct NetThread* thread, struct NetEvent* event);
+
+void netThreadAttach(struct NetThread* thread, size_t channel, struct Conn* conn);
+void netThreadDrop(struct NetThread* thread, size_t channel);
+// What the game wrote since is sent right away instead of on the next wake up
+void netThreadWake(struct NetThread* thread);
+
+#endif // NETTHREAD_H
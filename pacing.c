@@ -0,0 +1,95 @@
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "pacing.h"
+
+void framePacerInit(struct FramePacer* pacer, enum FrameMode mode, int frame_rate) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->mode = mode;
+    pacer->frequency = SDL_GetPerformanceFrequency();
+    pacer->period = frame_rate > 0 ? pacer->frequency / frame_rate : 0;
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    pacer->next = now + pacer->period;
+    pacer->last = now;
+    pacer->recent.start = now;
+    pacer->total.start = now;
+}
+
+static void frameTimesAdd(struct FrameTimes* times, uint64_t time) {
+    times->frames++;
+    times->sum += time;
+    times->sum_sq += (double)time*time;
+    if (time > times->max) times->max = time;
+}
+
+static void frameTimesStats(struct FrameTimes* times, uint64_t now, uint64_t frequency, struct FrameStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->frames = times->frames;
+    if (times->frames == 0) return;
+
+    double ms = 1000.0 / frequency;
+    double mean = times->sum / times->frames;
+    double variance = times->sum_sq / times->frames - mean*mean;
+
+    stats->fps = times->frames * (double)frequency / (now - times->start);
+    stats->mean = mean * ms;
+    stats->stddev = variance > 0 ? sqrt(variance) * ms : 0;
+    stats->max = times->max * ms;
+}
+
+static void frameSleepUntil(struct FramePacer* pacer, uint64_t until) {
+    uint64_t spin = pacer->frequency * FRAME_SPIN_US / 1000000;
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (until > now + spin) {
+        SDL_Delay((until - now - spin) * 1000 / pacer->frequency);
+    }
+
+    while (SDL_GetPerformanceCounter() < until) {
+    }
+}
+
+void framePacerWait(struct FramePacer* pacer) {
+    if (pacer->mode == FRAME_CAPPED) {
+        uint64_t now = SDL_GetPerformanceCounter();
+        if (now >= pacer->next) {
+            // Late, this frame takes the time it took
+            pacer->next = now;
+        } else {
+            frameSleepUntil(pacer, pacer->next);
+        }
+        pacer->next += pacer->period;
+    }
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    frameTimesAdd(&pacer->recent, now - pacer->last);
+    frameTimesAdd(&pacer->total, now - pacer->last);
+    pacer->last = now;
+
+    if ((now - pacer->recent.start) * 1000 / pacer->frequency >= FRAME_STATS_PERIOD) {
+        frameTimesStats(&pacer->recent, now, pacer->frequency, &pacer->stats);
+        memset(&pacer->recent, 0, sizeof(pacer->recent));
+        pacer->recent.start = now;
+    }
+}
+
+void framePacerTotal(struct FramePacer* pacer, struct FrameStats* stats) {
+    frameTimesStats(&pacer->total, pacer->last, pacer->frequency, stats);
+}
+
+void framePacerPrint(struct FramePacer* pacer, FILE* file) {
+    struct FrameStats stats;
+    framePacerTotal(pacer, &stats);
+    if (stats.frames == 0) return;
+
+    char* modes[] = {
+        [FRAME_CAPPED] = "capped",
+        [FRAME_VSYNC] = "vsync",
+        [FRAME_UNCAPPED] = "uncapped",
+    };
+    fprintf(file, "frames (%s):\n", modes[pacer->mode]);
+    fprintf(file, "    frames:            %"PRIu64", %.1f per second\n", stats.frames, stats.fps);
+    fprintf(file, "    frame time:        %.2f ms, +-%.2f ms, max %.2f ms\n", stats.mean, stats.stddev, stats.max);
+}
@@ -0,0 +1,72 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__linux__)
+#include <SDL2/SDL.h>
+#else
+#include <SDL.h>
+#endif
+
+#define DEFAULT_FRAME_RATE 60
+// Left to spin instead of sleeping, SDL_Delay may oversleep by about this
+#define FRAME_SPIN_US 1500
+// Milliseconds between updates of the recent stats
+#define FRAME_STATS_PERIOD 1000
+
+enum FrameMode {
+    // Sleeps what's left of each frame at the given rate
+    FRAME_CAPPED,
+    // Left to SDL_RenderPresent, which waits for the display
+    FRAME_VSYNC,
+    FRAME_UNCAPPED,
+};
+
+// Over the last FRAME_STATS_PERIOD, or the whole run
+struct FrameStats {
+    uint64_t frames;
+    float fps;
+    // Milliseconds from one frame to the next
+    float mean;
+    float stddev;
+    float max;
+};
+
+struct FrameTimes {
+    uint64_t frames;
+    uint64_t start;
+    // Counter ticks
+    double sum;
+    double sum_sq;
+    uint64_t max;
+};
+
+/*
+ * Ends every frame a fixed period after the last one ended, however long
+ * its work took: the rest of the period is slept with SDL_Delay up to the
+ * last FRAME_SPIN_US, which is spun on the high resolution counter. A frame
+ * that runs late starts the next period from when it ended, instead of the
+ * frames after it being rushed to catch up.
+ * */
+struct FramePacer {
+    enum FrameMode mode;
+    uint64_t frequency;
+    uint64_t period;
+    uint64_t next;
+    uint64_t last;
+
+    struct FrameTimes recent;
+    struct FrameTimes total;
+    struct FrameStats stats;
+};
+
+void framePacerInit(struct FramePacer* pacer, enum FrameMode mode, int frame_rate);
+// After SDL_RenderPresent
+void framePacerWait(struct FramePacer* pacer);
+void framePacerTotal(struct FramePacer* pacer, struct FrameStats* stats);
+void framePacerPrint(struct FramePacer* pacer, FILE* file);
+
+#endif // PACING_H
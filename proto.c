@@ -0,0 +1,521 @@
+#if defined(_WIN64) || defined(_WIN32)
+// rand_s
+#define _CRT_RAND_S
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "proto.h"
+
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+/*
+ * From the system's random number generator, not rand(): anyone who could
+ * guess a dropped player's token could take their place, and rand() is
+ * seeded with --seed or the time and also drives the game.
+ * */
+void sessionTokenNew(uint8_t* token) {
+#if defined(__linux__)
+    size_t size = 0;
+    while (size < SESSION_TOKEN_SIZE) {
+        ssize_t ret = getrandom(token + size, SESSION_TOKEN_SIZE - size, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret < 0 && errno == ENOSYS) break;
+        pcr(ret, "getrandom failed");
+        size += ret;
+    }
+
+    // Kernels older than getrandom
+    if (size < SESSION_TOKEN_SIZE) {
+        FILE* file = pcp(fopen("/dev/urandom", "rb"), "/dev/urandom");
+        if (fread(token, 1, SESSION_TOKEN_SIZE, file) != SESSION_TOKEN_SIZE) {
+            fprintf(stderr, "Can't read /dev/urandom\n");
+            exit(EXIT_FAILURE);
+        }
+        fclose(file);
+    }
+#elif defined(WINDOWS)
+    for (size_t i = 0; i < SESSION_TOKEN_SIZE; i++) {
+        unsigned int x;
+        if (rand_s(&x) != 0) {
+            fprintf(stderr, "rand_s failed\n");
+            exit(EXIT_FAILURE);
+        }
+        token[i] = x;
+    }
+#endif // defined
+}
+
+void welcomeWrite(uint8_t* data, uint8_t player_i, uint8_t* token) {
+    data[0] = player_i;
+    memcpy(data + 1, token, SESSION_TOKEN_SIZE);
+}
+
+bool welcomeRead(struct Msg* msg, uint8_t* player_i, uint8_t* token) {
+    if (msg->type != MSG_WELCOME || msg->size != WELCOME_SIZE) return false;
+
+    *player_i = msg->data[0];
+    memcpy(token, msg->data + 1, SESSION_TOKEN_SIZE);
+    return true;
+}
+
+void startGameWrite(uint8_t* data, uint32_t input_delay) {
+    data[0] = input_delay;
+}
+
+bool startGameRead(struct Msg* msg, uint32_t* input_delay) {
+    if (msg->type != MSG_START_GAME || msg->size != START_GAME_SIZE || msg->data[0] > MAX_INPUT_DELAY) return false;
+
+    *input_delay = msg->data[0];
+    return true;
+}
+
+// Inputs repeat until acknowledged, so a message carries up to INPUT_HISTORY_SIZE
+bool inputsRead(struct Msg* msg, struct InputCmd* inputs, size_t* inputs_size) {
+    if (msg->size < 1) return false;
+
+    size_t count = msg->data[0];
+    if (count > INPUT_HISTORY_SIZE || msg->size != 1 + count*INPUT_CMD_SIZE) return false;
+
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* p = msg->data + 1 + i*INPUT_CMD_SIZE;
+
+        inputs[i].seq = readU32(p);
+        inputs[i].tick = readU32(p + 4);
+        inputs[i].direc = (enum Direction)p[8];
+        inputs[i].sent_at = 0;
+    }
+    *inputs_size = count;
+
+    return true;
+}
+
+static void inputHistorySend(struct InputHistory* history, struct Conn* conn, uint32_t now) {
+    uint8_t data[1 + INPUT_HISTORY_SIZE*INPUT_CMD_SIZE];
+
+    data[0] = history->inputs_size;
+    for (size_t i = 0; i < history->inputs_size; i++) {
+        uint8_t* p = data + 1 + i*INPUT_CMD_SIZE;
+        writeU32(p, history->inputs[i].seq);
+        writeU32(p + 4, history->inputs[i].tick);
+        p[8] = history->inputs[i].direc;
+    }
+
+    connSend(conn, MSG_INPUT, data, 1 + history->inputs_size*INPUT_CMD_SIZE);
+    history->last_send = now;
+}
+
+void inputHistoryAdd(struct InputHistory* history, struct Conn* conn, enum Direction direc, uint32_t tick, uint32_t now) {
+    // Too old to matter anymore
+    if (history->inputs_size == INPUT_HISTORY_SIZE) {
+        history->inputs_size--;
+        memmove(history->inputs, &history->inputs[1], history->inputs_size*sizeof(struct InputCmd));
+    }
+
+    struct InputCmd* cmd = &history->inputs[history->inputs_size++];
+    cmd->seq = ++history->next_seq;
+    cmd->tick = tick;
+    cmd->direc = direc;
+    cmd->sent_at = now;
+
+    inputHistorySend(history, conn, now);
+}
+
+/*
+ * Forget what the host acknowledged and resend the rest every so often.
+ * The latency of each acknowledged input is written to `latencies` if it
+ * isn't NULL, which must have room for INPUT_HISTORY_SIZE. Returns how many
+ * were acknowledged.
+ * */
+size_t inputHistoryAck(struct InputHistory* history, struct Conn* conn, uint32_t ack, uint32_t now, uint32_t* latencies) {
+    size_t acked = 0;
+    while (acked < history->inputs_size && history->inputs[acked].seq <= ack) {
+        uint32_t latency = now - history->inputs[acked].sent_at;
+        history->latency = history->latency ? (history->latency*7 + latency) / 8 : latency;
+        if (latencies) latencies[acked] = latency;
+        acked++;
+    }
+
+    history->inputs_size -= acked;
+    memmove(history->inputs, &history->inputs[acked], history->inputs_size*sizeof(struct InputCmd));
+
+    if (history->inputs_size > 0 && now - history->last_send > INPUT_RESEND_DELAY) {
+        inputHistorySend(history, conn, now);
+    }
+
+    return acked;
+}
+
+// From a state's tick and time. Ticks going back mean a new match.
+void matchClockUpdate(struct MatchClock* clock, uint32_t tick, uint32_t time) {
+    if (!clock->started || tick < clock->tick) {
+        clock->started = true;
+        clock->tick = tick;
+        clock->time = time;
+        // Until measured, the game's 60 per second
+        if (clock->tick_time == 0) clock->tick_time = 1000*256 / 60;
+        return;
+    }
+    if (tick == clock->tick) return;
+
+    uint32_t tick_time = (uint64_t)(time - clock->time)*256 / (tick - clock->tick);
+    clock->tick_time = (clock->tick_time*7 + tick_time) / 8;
+    if (clock->tick_time == 0) clock->tick_time = 1;
+
+    clock->tick = tick;
+    clock->time = time;
+}
+
+// How long ago the newest state was sent, in host time
+uint32_t matchClockAge(struct MatchClock* clock, uint32_t host_now) {
+    int32_t age = (int32_t)(host_now - clock->time);
+    return age > 0 ? age : 0;
+}
+
+// The tick the host is on at host_now
+uint32_t matchClockTick(struct MatchClock* clock, uint32_t host_now) {
+    if (!clock->started) return 0;
+
+    return clock->tick + (uint64_t)matchClockAge(clock, host_now)*256 / clock->tick_time;
+}
+
+// Positions are sent as one byte per coordinate
+_Static_assert(GRID_SIZE <= 256, "positions don't fit in a byte");
+
+// Indexed by Direction
+static const int8_t step_x[4] = {[DOWN] = 0, [LEFT] = -1, [RIGHT] = 1, [UP] = 0};
+static const int8_t step_y[4] = {[DOWN] = 1, [LEFT] = 0, [RIGHT] = 0, [UP] = -1};
+
+// The direction that takes `from` to `to` in one step, with wraparound
+static bool stepDirection(struct Pos from, struct Pos to, uint8_t* direc) {
+    int dx = (to.x - from.x + GRID_SIZE) % GRID_SIZE;
+    int dy = (to.y - from.y + GRID_SIZE) % GRID_SIZE;
+
+    if (dy == 0 && dx == 1) *direc = RIGHT;
+    else if (dy == 0 && dx == GRID_SIZE-1) *direc = LEFT;
+    else if (dx == 0 && dy == 1) *direc = DOWN;
+    else if (dx == 0 && dy == GRID_SIZE-1) *direc = UP;
+    else return false;
+
+    return true;
+}
+
+// Writes at most BODY_CODE_MAX_SIZE bytes, returns how many
+size_t bodyEncode(struct Pos head, struct Pos* body, size_t body_size, uint8_t* data) {
+    writeU16(data + 1, body_size);
+    uint8_t* p = data + 3;
+
+    data[0] = BODY_CHAIN;
+    memset(p, 0, (body_size + 3) / 4);
+
+    struct Pos prev = head;
+    for (size_t i = 0; i < body_size; i++) {
+        uint8_t direc;
+        if (!stepDirection(prev, body[i], &direc)) {
+            data[0] = BODY_RAW;
+            break;
+        }
+        p[i / 4] |= direc << (i % 4 * 2);
+        prev = body[i];
+    }
+
+    if (data[0] == BODY_CHAIN) {
+        return 3 + (body_size + 3) / 4;
+    }
+
+    for (size_t i = 0; i < body_size; i++) {
+        p[i*2] = body[i].x;
+        p[i*2 + 1] = body[i].y;
+    }
+    return 3 + body_size*2;
+}
+
+// Returns how many bytes were read, 0 if they aren't a valid body
+size_t bodyDecode(struct Pos head, struct Pos* body, size_t* body_size, uint8_t* data, size_t data_size) {
+    if (data_size < 3) return 0;
+
+    size_t size = readU16(data + 1);
+    if (size > BODY_SIZE) return 0;
+
+    uint8_t* p = data + 3;
+    *body_size = size;
+
+    if (data[0] == BODY_RAW) {
+        if (data_size < 3 + size*2) return 0;
+
+        for (size_t i = 0; i < size; i++) {
+            if (p[i*2] >= GRID_SIZE || p[i*2 + 1] >= GRID_SIZE) return 0;
+            body[i].x = p[i*2];
+            body[i].y = p[i*2 + 1];
+        }
+        return 3 + size*2;
+    }
+
+    if (data[0] != BODY_CHAIN || data_size < 3 + (size + 3) / 4) return 0;
+
+    int x = head.x;
+    int y = head.y;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t direc = p[i / 4] >> (i % 4 * 2) & 3;
+
+        x += step_x[direc];
+        y += step_y[direc];
+        if (x < 0) x += GRID_SIZE;
+        else if (x >= GRID_SIZE) x -= GRID_SIZE;
+        if (y < 0) y += GRID_SIZE;
+        else if (y >= GRID_SIZE) y -= GRID_SIZE;
+
+        body[i].x = x;
+        body[i].y = y;
+    }
+    return 3 + (size + 3) / 4;
+}
+
+// Reads stop at the end of the message, after which everything reads as 0
+struct Reader {
+    uint8_t* p;
+    uint8_t* end;
+    bool ok;
+};
+
+static uint8_t* readerTake(struct Reader* reader, size_t size) {
+    static uint8_t zeros[4];
+
+    if (!reader->ok || (size_t)(reader->end - reader->p) < size) {
+        reader->ok = false;
+        return zeros;
+    }
+
+    uint8_t* p = reader->p;
+    reader->p += size;
+    return p;
+}
+
+static uint8_t readerU8(struct Reader* reader) {
+    return *readerTake(reader, 1);
+}
+
+static uint16_t readerU16(struct Reader* reader) {
+    return readU16(readerTake(reader, 2));
+}
+
+static uint32_t readerU32(struct Reader* reader) {
+    return readU32(readerTake(reader, 4));
+}
+
+static bool readerPos(struct Reader* reader, struct Pos* pos) {
+    pos->x = readerU8(reader);
+    pos->y = readerU8(reader);
+    return pos->x < GRID_SIZE && pos->y < GRID_SIZE;
+}
+
+bool interestCoversArena(struct Interest* interest) {
+    return interest->radius*2 + 1 >= GRID_SIZE;
+}
+
+static int wrapDistance(int a, int b) {
+    int d = a > b ? a - b : b - a;
+    return d < GRID_SIZE - d ? d : GRID_SIZE - d;
+}
+
+bool interestContains(struct Interest* interest, struct Pos pos) {
+    return wrapDistance(interest->center.x, pos.x) <= interest->radius
+        && wrapDistance(interest->center.y, pos.y) <= interest->radius;
+}
+
+static bool interested(struct Interest* interest, struct Pos pos) {
+    return !interest || interestContains(interest, pos);
+}
+
+static uint8_t* writePlayer(struct Player* player, struct Interest* interest, uint8_t* p) {
+    writeU32(p, player->score); p += 4;
+    *p++ = player->game_over;
+    writeU32(p, player->last_movem_frame); p += 4;
+    writeU32(p, player->movem_delay); p += 4;
+    *p++ = player->pos.x;
+    *p++ = player->pos.y;
+    *p++ = player->direc;
+    *p++ = player->direc_size;
+    *p++ = player->direc_i;
+    for (int i = 0; i < player->direc_size; i++) {
+        *p++ = player->direc_buff[i];
+    }
+    *p++ = player->reset_buffer_on_input;
+    writeU32(p, player->zombie_end); p += 4;
+    writeU32(p, player->zombie_duration); p += 4;
+    writeU32(p, player->sonic_end); p += 4;
+    writeU32(p, player->sonic_duration); p += 4;
+
+    size_t body_size = player->body_size;
+    while (body_size > 0 && !interested(interest, player->body[body_size-1])) {
+        body_size--;
+    }
+
+    return p + bodyEncode(player->pos, player->body, body_size, p);
+}
+
+static bool readPlayer(struct Player* player, struct Reader* reader) {
+    player->score = (int32_t)readerU32(reader);
+    player->game_over = readerU8(reader);
+    player->last_movem_frame = readerU32(reader);
+    player->movem_delay = readerU32(reader);
+    if (!readerPos(reader, &player->pos)) return false;
+
+    uint8_t direc = readerU8(reader);
+    if (direc > UP) return false;
+    player->direc = (enum Direction)direc;
+
+    player->direc_size = readerU8(reader);
+    player->direc_i = readerU8(reader);
+    if (player->direc_size > DIREC_BUFFER_SIZE || player->direc_i > player->direc_size) return false;
+    for (int i = 0; i < player->direc_size; i++) {
+        direc = readerU8(reader);
+        if (direc > UP) return false;
+        player->direc_buff[i] = (enum Direction)direc;
+    }
+
+    player->reset_buffer_on_input = readerU8(reader);
+    player->zombie_end = readerU32(reader);
+    player->zombie_duration = readerU32(reader);
+    player->sonic_end = readerU32(reader);
+    player->sonic_duration = readerU32(reader);
+    if (!reader->ok) return false;
+
+    size_t read = bodyDecode(player->pos, player->body, &player->body_size, reader->p, reader->end - reader->p);
+    reader->p += read;
+    return read > 0;
+}
+
+// Writes at most STATE_MAX_SIZE bytes, returns how many
+size_t stateWrite(struct GameState* game_state, struct Interest* interest, uint32_t now, uint8_t* data) {
+    uint8_t* p = data;
+
+    writeU32(p, game_state->tick); p += 4;
+    writeU32(p, now); p += 4;
+    *p++ = game_state->players_size;
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        writeU32(p, game_state->players[i].last_input_seq); p += 4;
+    }
+
+    struct AppleSpawner* spawner = &game_state->apple_spawner;
+    writeU32(p, spawner->last_spawn_frame); p += 4;
+    writeU32(p, spawner->spawn_delay); p += 4;
+    uint8_t* apples_size = p; p += 2;
+    uint16_t apples_sent = 0;
+    for (size_t i = 0; i < spawner->apples_size; i++) {
+        if (!interested(interest, spawner->apples[i].pos)) continue;
+
+        *p++ = spawner->apples[i].pos.x;
+        *p++ = spawner->apples[i].pos.y;
+        *p++ = spawner->apples[i].type;
+        apples_sent++;
+    }
+    writeU16(apples_size, apples_sent);
+
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        p = writePlayer(&game_state->players[i], interest, p);
+    }
+
+    uint8_t* dead_bodies_size = p; p += 2;
+    uint16_t dead_bodies_sent = 0;
+    for (size_t i = 0; i < game_state->dead_bodies_size; i++) {
+        if (!interested(interest, game_state->dead_bodies[i])) continue;
+
+        *p++ = game_state->dead_bodies[i].x;
+        *p++ = game_state->dead_bodies[i].y;
+        dead_bodies_sent++;
+    }
+    writeU16(dead_bodies_size, dead_bodies_sent);
+
+    return p - data;
+}
+
+struct SharedBuf* stateEncode(struct GameState* game_state, struct Interest* interest, uint32_t now) {
+    uint8_t data[STATE_MAX_SIZE];
+    size_t size = stateWrite(game_state, interest, now, data);
+    return sharedBufNew(MSG_STATE, data, size);
+}
+
+// Peek at the tick without decoding the whole state
+bool stateTick(struct Msg* msg, uint32_t* tick) {
+    if (msg->type != MSG_STATE || msg->size < STATE_HEADER_SIZE) return false;
+
+    *tick = readU32(msg->data);
+    return true;
+}
+
+// Host time the state was sent at
+bool stateTime(struct Msg* msg, uint32_t* time) {
+    if (msg->type != MSG_STATE || msg->size < STATE_HEADER_SIZE) return false;
+
+    *time = readU32(msg->data + 4);
+    return true;
+}
+
+bool stateRead(struct Msg* msg, struct GameState* game_state) {
+    if (msg->type != MSG_STATE) return false;
+
+    struct Reader reader = {.p = msg->data, .end = msg->data + msg->size, .ok = true};
+
+    game_state->tick = readerU32(&reader);
+    readerU32(&reader); // Host time, see stateTime
+    game_state->players_size = readerU8(&reader);
+    if (game_state->players_size > MAX_PLAYERS_SIZE) return false;
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        game_state->players[i].last_input_seq = readerU32(&reader);
+    }
+
+    struct AppleSpawner* spawner = &game_state->apple_spawner;
+    spawner->last_spawn_frame = readerU32(&reader);
+    spawner->spawn_delay = readerU32(&reader);
+    spawner->apples_size = readerU16(&reader);
+    if (spawner->apples_size > APPLES_SIZE) return false;
+    for (size_t i = 0; i < spawner->apples_size; i++) {
+        if (!readerPos(&reader, &spawner->apples[i].pos)) return false;
+
+        uint8_t type = readerU8(&reader);
+        if (type >= POWERUP_SIZE) return false;
+        spawner->apples[i].type = (enum Powerup)type;
+    }
+
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        if (!readPlayer(&game_state->players[i], &reader)) return false;
+    }
+
+    game_state->dead_bodies_size = readerU16(&reader);
+    if (game_state->dead_bodies_size > DEAD_BODIES_SIZE) return false;
+    for (size_t i = 0; i < game_state->dead_bodies_size; i++) {
+        if (!readerPos(&reader, &game_state->dead_bodies[i])) return false;
+    }
+
+    return reader.ok && reader.p == reader.end;
+}
+
+// What the host acknowledged of a player's inputs, without decoding the state
+bool stateInputAck(struct Msg* msg, size_t player_i, uint32_t* ack) {
+    if (msg->type != MSG_STATE || msg->size < STATE_HEADER_SIZE || player_i >= msg->data[8]) return false;
+    if (msg->size < STATE_HEADER_SIZE + (player_i + 1)*4) return false;
+
+    *ack = readU32(msg->data + STATE_HEADER_SIZE + player_i*4);
+    return true;
+}
+
+void tickStatsWrite(uint8_t* data, struct TickStats* stats) {
+    writeU32(data, stats->p50);
+    writeU32(data + 4, stats->p90);
+    writeU32(data + 8, stats->p99);
+    writeU32(data + 12, stats->max);
+}
+
+bool tickStatsRead(struct Msg* msg, struct TickStats* stats) {
+    if (msg->type != MSG_TICK_STATS || msg->size != TICK_STATS_SIZE) return false;
+
+    stats->p50 = readU32(msg->data);
+    stats->p90 = readU32(msg->data + 4);
+    stats->p99 = readU32(msg->data + 8);
+    stats->max = readU32(msg->data + 12);
+    return true;
+}
@@ -0,0 +1,171 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include "game.h"
+#include "net.h"
+
+// What the game sends over a Conn, shared by the game, server and tools
+
+// Asked for in MSG_JOIN
+enum Role {
+    ROLE_JOINING,
+    ROLE_PLAYER,
+    ROLE_SPECTATOR,
+    // Host side only, sent MSG_RESUME and waiting for its slot to be found
+    ROLE_RESUMING,
+    // Host side only, asked to watch and waiting for a match to be found
+    ROLE_WATCHING,
+};
+
+// Sent in MSG_WELCOME instead of a player index
+#define SPECTATOR_I 0xFF
+
+/*
+ * Players get a session token in MSG_WELCOME. A player whose connection is
+ * lost keeps its slot for RESUME_GRACE, its snake going on straight, and can
+ * take it back by sending the token in MSG_RESUME from a new connection.
+ * The host answers with MSG_WELCOME and the current state right away.
+ * */
+#define SESSION_TOKEN_SIZE 8
+#define RESUME_GRACE 5000
+#define RECONNECT_DELAY 250
+
+// player index (u8), session token
+#define WELCOME_SIZE (1 + SESSION_TOKEN_SIZE)
+
+/*
+ * Online input. The client keeps resending everything the host hasn't
+ * acknowledged (through Player.last_input_seq), so a lost message is
+ * recovered by the next one instead of by a round trip.
+ * */
+#define INPUT_HISTORY_SIZE 8
+#define INPUT_RESEND_DELAY 50
+// seq (u32), tick (u32), direction (u8)
+#define INPUT_CMD_SIZE 9
+
+struct InputCmd {
+    uint32_t seq;
+    // Host tick the input applies to
+    uint32_t tick;
+    enum Direction direc;
+
+    // Client only, not sent
+    uint32_t sent_at;
+};
+
+// Client side of the input stream
+struct InputHistory {
+    // Sent but not acknowledged yet, oldest first
+    struct InputCmd inputs[INPUT_HISTORY_SIZE];
+    size_t inputs_size;
+    uint32_t next_seq;
+    uint32_t last_send;
+
+    // Smoothed time from a keypress to the first state that includes it
+    uint32_t latency;
+};
+
+/*
+ * Every player's input, the host's own included, applies input_delay ticks
+ * after it's pressed, so players closer to the host don't get their turns in
+ * first. The host picks it when the match starts, just long enough for the
+ * farthest player's inputs to make it in time, and sends it in
+ * MSG_START_GAME (u8).
+ * */
+#define MAX_INPUT_DELAY 30
+#define INPUT_DELAY_AUTO -1
+#define START_GAME_SIZE 1
+
+// How long the host's ticks took over the last STATS_PERIOD, in microseconds
+struct TickStats {
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+};
+
+#define TICK_STATS_SIZE 16
+
+/*
+ * The match clock: which tick the host is on, as a client sees it. States
+ * carry the host time they were sent at, so with the host's clock from the
+ * connection (connRemoteTime) a client knows how old a state is and can count
+ * the ticks since. The length of a tick is measured from the states too.
+ * */
+struct MatchClock {
+    bool started;
+    // Newest state seen and the host time it was sent at
+    uint32_t tick;
+    uint32_t time;
+    // Smoothed, in 1/256 ms
+    uint32_t tick_time;
+};
+
+void sessionTokenNew(uint8_t* token);
+void welcomeWrite(uint8_t* data, uint8_t player_i, uint8_t* token);
+bool welcomeRead(struct Msg* msg, uint8_t* player_i, uint8_t* token);
+
+void startGameWrite(uint8_t* data, uint32_t input_delay);
+bool startGameRead(struct Msg* msg, uint32_t* input_delay);
+
+bool inputsRead(struct Msg* msg, struct InputCmd* inputs, size_t* inputs_size);
+
+void inputHistoryAdd(struct InputHistory* history, struct Conn* conn, enum Direction direc, uint32_t tick, uint32_t now);
+size_t inputHistoryAck(struct InputHistory* history, struct Conn* conn, uint32_t ack, uint32_t now, uint32_t* latencies);
+
+void matchClockUpdate(struct MatchClock* clock, uint32_t tick, uint32_t time);
+uint32_t matchClockTick(struct MatchClock* clock, uint32_t host_now);
+uint32_t matchClockAge(struct MatchClock* clock, uint32_t host_now);
+
+/*
+ * Snake bodies are sent as a chain: each segment is one step from the one
+ * before it (the head, for the first), so it's sent as the Direction of that
+ * step in 2 bits. A body that isn't a chain, like right after growing without
+ * moving, is sent as raw positions instead.
+ *
+ * kind (u8), body_size (u16), then 4 steps per byte from the low bits, or
+ * x and y (u8) per segment.
+ * */
+#define BODY_CHAIN 0
+#define BODY_RAW 1
+#define BODY_CODE_MAX_SIZE (3 + 2*BODY_SIZE)
+
+size_t bodyEncode(struct Pos head, struct Pos* body, size_t body_size, uint8_t* data);
+size_t bodyDecode(struct Pos head, struct Pos* body, size_t* body_size, uint8_t* data, size_t data_size);
+
+/*
+ * A state starts with tick (u32), the host time it was sent at (u32),
+ * players_size (u8) and the last_input_seq (u32) of every player, so clients
+ * that only need those don't decode the rest.
+ * */
+#define STATE_HEADER_SIZE 9
+#define PLAYER_CODE_MAX_SIZE (37 + BODY_CODE_MAX_SIZE)
+#define STATE_MAX_SIZE (STATE_HEADER_SIZE + 4*MAX_PLAYERS_SIZE + 10 + 3*APPLES_SIZE + MAX_PLAYERS_SIZE*PLAYER_CODE_MAX_SIZE + 2 + 2*DEAD_BODIES_SIZE)
+
+/*
+ * The part of the arena a client is sent, a square around its head that
+ * wraps around like the arena does. Apples and dead bodies outside of it are
+ * left out, and bodies end at their last segment inside it. Heads are always
+ * sent, they're needed for the chain and the scores.
+ * */
+struct Interest {
+    struct Pos center;
+    int radius;
+};
+
+bool interestCoversArena(struct Interest* interest);
+bool interestContains(struct Interest* interest, struct Pos pos);
+
+// With interest NULL, everything is written
+size_t stateWrite(struct GameState* game_state, struct Interest* interest, uint32_t now, uint8_t* data);
+struct SharedBuf* stateEncode(struct GameState* game_state, struct Interest* interest, uint32_t now);
+bool stateTick(struct Msg* msg, uint32_t* tick);
+bool stateTime(struct Msg* msg, uint32_t* time);
+// game_state may be partly written if the message is malformed
+bool stateRead(struct Msg* msg, struct GameState* game_state);
+bool stateInputAck(struct Msg* msg, size_t player_i, uint32_t* ack);
+
+void tickStatsWrite(uint8_t* data, struct TickStats* stats);
+bool tickStatsRead(struct Msg* msg, struct TickStats* stats);
+
+#endif // PROTO_H
@@ -0,0 +1,533 @@
+#include <string.h>
+
+#include "room.h"
+
+void roomInit(struct Room* room, struct GameState* game_state) {
+    memset(room, 0, sizeof(*room));
+    room->game_state = game_state;
+    room->interest_radius = INTEREST_RADIUS;
+    room->input_delay_config = INPUT_DELAY_AUTO;
+    room->tick_time = DEFAULT_TICK_TIME;
+}
+
+void roomClose(struct Room* room) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (!peer) continue;
+
+        connClose(&peer->conn);
+        free(peer);
+        room->peers[i] = NULL;
+    }
+}
+
+// Returns NULL if there's no room, not even to watch
+struct Peer* roomAccept(struct Room* room, int fd, uint32_t now) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (peer && (peer->conn.open || peer->lost)) continue;
+
+        if (!peer) {
+            peer = pcp(malloc(sizeof(*peer)), "malloc failed");
+            room->peers[i] = peer;
+        }
+
+        unblock(fd);
+        connInit(&peer->conn, fd);
+        peer->role = ROLE_JOINING;
+        peer->accepted_at = now;
+        peer->lost = false;
+
+        peer->snapshot_interval = 1;
+        peer->last_snapshot_tick = 0;
+        peer->radius = room->interest_radius;
+        peer->snapshot_size = 0;
+        peer->adapted_period = 0;
+        peer->adapted_dropped = 0;
+        return peer;
+    }
+
+    return NULL;
+}
+
+size_t roomPeersSize(struct Room* room) {
+    size_t size = 0;
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        if (room->peers[i] && room->peers[i]->conn.open) size++;
+    }
+    return size;
+}
+
+bool roomPeerWelcomed(struct Peer* peer) {
+    return peer->role == ROLE_PLAYER || peer->role == ROLE_SPECTATOR;
+}
+
+static void roomSendWelcome(struct Room* room, struct Peer* peer) {
+    uint8_t data[WELCOME_SIZE];
+    welcomeWrite(data, peer->role == ROLE_PLAYER ? peer->player_i : SPECTATOR_I, peer->token);
+    connSend(&peer->conn, MSG_WELCOME, data, sizeof(data));
+
+    if (room->running) {
+        uint8_t start[START_GAME_SIZE];
+        startGameWrite(start, room->input_delay);
+        connSend(&peer->conn, MSG_START_GAME, start, sizeof(start));
+    }
+}
+
+// Players can only join from the lobby, everyone else watches
+static void roomWelcome(struct Room* room, struct Peer* peer, enum Role role) {
+    memset(peer->token, 0, sizeof(peer->token));
+
+    if (role == ROLE_PLAYER && !room->running && room->game_state->players_size < MAX_PLAYERS_SIZE) {
+        peer->role = ROLE_PLAYER;
+        peer->player_i = room->game_state->players_size++;
+        peer->inputs_size = 0;
+        peer->last_input_seq = 0;
+        memset(&peer->input_stats, 0, sizeof(peer->input_stats));
+        sessionTokenNew(peer->token);
+    } else {
+        peer->role = ROLE_SPECTATOR;
+    }
+
+    roomSendWelcome(room, peer);
+}
+
+// Where a peer is looking, NULL if it sees the whole arena
+static bool roomPeerInterest(struct Room* room, struct Peer* peer, struct Interest* interest) {
+    if (peer->role != ROLE_PLAYER) return false;
+
+    struct Player* player = &room->game_state->players[peer->player_i];
+    if (player->game_over) return false;
+
+    interest->center = player->pos;
+    interest->radius = peer->radius;
+    return !interestCoversArena(interest);
+}
+
+// Everyone seeing the whole arena shares the state in full, encoded when
+// first needed. The caller unrefs it.
+static void roomSendState(struct Room* room, struct Peer* peer, struct SharedBuf** full, uint32_t now) {
+    struct Interest interest;
+    struct SharedBuf* buf;
+    if (roomPeerInterest(room, peer, &interest)) {
+        buf = stateEncode(room->game_state, &interest, now);
+    } else {
+        if (!*full) *full = stateEncode(room->game_state, NULL, now);
+        buf = sharedBufRef(*full);
+    }
+
+    connSendSnapshot(&peer->conn, buf, now);
+    peer->last_snapshot_tick = room->game_state->tick;
+    peer->snapshot_size = peer->snapshot_size ? (peer->snapshot_size*7 + buf->size) / 8 : buf->size;
+    sharedBufUnref(buf);
+}
+
+/*
+ * Once per STATS_PERIOD of the connection. A backed up one is sent as many
+ * states as fit in three quarters of what it took last period, the rest
+ * left to drain the queue, and past SNAPSHOT_MAX_INTERVAL a smaller area.
+ * One that keeps up wins back a step.
+ * */
+static void roomPeerAdapt(struct Room* room, struct Peer* peer) {
+    struct ConnStats* stats = &peer->conn.stats;
+    if (stats->period_start == peer->adapted_period) return;
+    peer->adapted_period = stats->period_start;
+
+    bool dropped = stats->snapshots_dropped > peer->adapted_dropped;
+    peer->adapted_dropped = stats->snapshots_dropped;
+
+    // Queued here, or further down the path as seen from the pings that
+    // wait behind the states
+    uint32_t queue_delay = connQueueDelay(&peer->conn);
+    uint32_t path_delay = stats->has_rtt ? stats->rtt - stats->rtt_min : 0;
+    if (path_delay > queue_delay) queue_delay = path_delay;
+
+    if (queue_delay > SNAPSHOT_MAX_QUEUE_DELAY || dropped) {
+        uint32_t ticks_per_sec = 1000 / room->tick_time;
+        uint32_t states_per_sec = 0;
+        if (peer->snapshot_size > 0) {
+            states_per_sec = (uint64_t)stats->delivered_rate*3/4 / peer->snapshot_size;
+        }
+
+        uint32_t interval = SNAPSHOT_MAX_INTERVAL + 1;
+        if (states_per_sec > 0) {
+            interval = (ticks_per_sec + states_per_sec - 1) / states_per_sec;
+        }
+        if (interval < peer->snapshot_interval) interval = peer->snapshot_interval;
+
+        if (interval > SNAPSHOT_MAX_INTERVAL) {
+            interval = SNAPSHOT_MAX_INTERVAL;
+            peer->radius = peer->radius*3/4;
+            if (peer->radius < SNAPSHOT_MIN_RADIUS) peer->radius = SNAPSHOT_MIN_RADIUS;
+        }
+        peer->snapshot_interval = interval;
+    } else if (queue_delay < SNAPSHOT_MAX_QUEUE_DELAY/4) {
+        if (peer->radius < room->interest_radius) {
+            peer->radius += 2;
+            if (peer->radius > room->interest_radius) peer->radius = room->interest_radius;
+        } else if (peer->snapshot_interval > 1) {
+            peer->snapshot_interval--;
+        }
+    }
+}
+
+// Getting fewer states or less of the arena than everyone else
+bool roomPeerThrottled(struct Room* room, struct Peer* peer) {
+    return peer->snapshot_interval > 1 || peer->radius < room->interest_radius;
+}
+
+// A player whose connection is gone keeps playing for RESUME_GRACE, then
+// it's out of the match
+static void roomPeerLost(struct Room* room, struct Peer* peer, uint32_t now) {
+    if (peer->role != ROLE_PLAYER) return;
+
+    struct Player* player = &room->game_state->players[peer->player_i];
+    if (player->game_over) {
+        peer->lost = false;
+    } else if (!peer->lost) {
+        peer->lost = true;
+        peer->lost_at = now;
+    } else if (now - peer->lost_at >= RESUME_GRACE) {
+        peer->lost = false;
+        player->game_over = true;
+    }
+}
+
+// Inputs repeat until acknowledged, only new ones are queued
+static void roomReadInputs(struct Room* room, struct Peer* peer, struct Msg* msg) {
+    struct InputCmd cmds[INPUT_HISTORY_SIZE];
+    size_t cmds_size;
+    if (!inputsRead(msg, cmds, &cmds_size)) return;
+
+    uint32_t tick = room->game_state->tick;
+
+    for (size_t i = 0; i < cmds_size; i++) {
+        struct InputCmd cmd = cmds[i];
+
+        if (cmd.seq <= peer->last_input_seq) continue;
+
+        // Not acknowledged, so it's sent again once there's room
+        if (peer->inputs_size == INPUT_QUEUE_SIZE) break;
+
+        peer->last_input_seq = cmd.seq;
+        if (cmd.direc > UP) continue;
+
+        if (cmd.tick > tick + MAX_INPUT_LEAD) {
+            cmd.tick = tick + MAX_INPUT_LEAD;
+        }
+
+        peer->inputs[peer->inputs_size++] = cmd;
+    }
+
+    room->game_state->players[peer->player_i].last_input_seq = peer->last_input_seq;
+}
+
+// Handle everything players and spectators sent since the last tick
+void roomRecv(struct Room* room, uint32_t now) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (!peer) continue;
+
+        if (!connRecv(&peer->conn, now)) {
+            roomPeerLost(room, peer, now);
+            continue;
+        }
+
+        struct Msg msg;
+        while (connNextMsg(&peer->conn, &msg)) {
+            switch (msg.type) {
+            case MSG_JOIN: {
+                if (peer->role == ROLE_JOINING && msg.size == 1) {
+                    if (msg.data[0] == ROLE_PLAYER) {
+                        roomWelcome(room, peer, ROLE_PLAYER);
+                    } else {
+                        peer->role = ROLE_WATCHING;
+                    }
+                }
+            } break;
+            case MSG_RESUME: {
+                if (peer->role == ROLE_JOINING && msg.size == SESSION_TOKEN_SIZE) {
+                    peer->role = ROLE_RESUMING;
+                    memcpy(peer->token, msg.data, SESSION_TOKEN_SIZE);
+                }
+            } break;
+            case MSG_INPUT: {
+                if (peer->role == ROLE_PLAYER) {
+                    roomReadInputs(room, peer, &msg);
+                }
+            } break;
+            default: break;
+            }
+        }
+
+        // Signed, one accepted since now was read is a little ahead of it
+        if (peer->role == ROLE_JOINING && (int32_t)(now - peer->accepted_at) > JOIN_TIMEOUT) {
+            connClose(&peer->conn);
+        }
+    }
+}
+
+// The host's own keypresses wait input_delay ticks like everyone else's
+void roomLocalInput(struct Room* room, enum Direction direc) {
+    if (room->local_inputs_size == INPUT_QUEUE_SIZE) return;
+
+    struct InputCmd* cmd = &room->local_inputs[room->local_inputs_size++];
+    cmd->seq = 0;
+    cmd->tick = room->game_state->tick + room->input_delay;
+    cmd->direc = direc;
+    cmd->sent_at = 0;
+}
+
+// Queued inputs are applied once their tick comes and the player's direction
+// buffer has room, so none are lost to a full buffer
+static void roomApplyQueue(struct Room* room, struct Player* player, struct InputCmd* inputs, size_t* inputs_size, struct InputDelayStats* stats) {
+    uint32_t tick = room->game_state->tick;
+
+    size_t applied = 0;
+    while (applied < *inputs_size && inputs[applied].tick <= tick && playerHasDirecRoom(player)) {
+        addDirection(player, inputs[applied].direc);
+
+        // From the tick it was pressed on, by the client's clock
+        int32_t delay = (int32_t)(tick - inputs[applied].tick) + (int32_t)room->input_delay;
+        uint32_t delay_ms = (delay > 0 ? delay : 0) * room->tick_time;
+        stats->delay = stats->applied ? (stats->delay*7 + delay_ms) / 8 : delay_ms;
+        stats->applied++;
+        if (inputs[applied].tick < tick) stats->late++;
+
+        applied++;
+    }
+
+    *inputs_size -= applied;
+    memmove(inputs, &inputs[applied], *inputs_size*sizeof(struct InputCmd));
+}
+
+void roomApplyInputs(struct Room* room) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (!peer || !(peer->conn.open || peer->lost) || peer->role != ROLE_PLAYER) continue;
+
+        struct Player* player = &room->game_state->players[peer->player_i];
+        roomApplyQueue(room, player, peer->inputs, &peer->inputs_size, &peer->input_stats);
+    }
+
+    if (room->local_inputs_size > 0) {
+        roomApplyQueue(room, &room->game_state->players[0], room->local_inputs, &room->local_inputs_size, &room->local_input_stats);
+    }
+}
+
+// Send a message to every player and spectator
+void roomBroadcast(struct Room* room, enum MsgType type, void* data, size_t data_size) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (peer && peer->conn.open && roomPeerWelcomed(peer)) {
+            connSend(&peer->conn, type, data, data_size);
+        }
+    }
+}
+
+// Everyone whose turn it is, see roomPeerAdapt
+void roomBroadcastState(struct Room* room, uint32_t now) {
+    struct SharedBuf* full = NULL;
+
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (!peer || !peer->conn.open || !roomPeerWelcomed(peer)) continue;
+
+        roomPeerAdapt(room, peer);
+        if (room->game_state->tick - peer->last_snapshot_tick < peer->snapshot_interval) continue;
+
+        roomSendState(room, peer, &full, now);
+    }
+
+    if (full) sharedBufUnref(full);
+}
+
+// Tell everyone in the lobby how many players there are, every so often
+void roomLobbyUpdate(struct Room* room, uint32_t now) {
+    if (now - room->last_lobby_update < LOBBY_UPDATE_DELAY) return;
+    room->last_lobby_update = now;
+
+    uint8_t players_size = room->game_state->players_size;
+    roomBroadcast(room, MSG_LOBBY_UPDATE, &players_size, sizeof(players_size));
+}
+
+// Whether every player's round trip is known, to pick the input delay from
+bool roomRttsKnown(struct Room* room) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (peer && peer->conn.open && peer->role == ROLE_PLAYER && !peer->conn.stats.has_rtt) return false;
+    }
+    return true;
+}
+
+/*
+ * Long enough for an input to make it from the farthest player: half its
+ * round trip, and the difference from its lowest round trip for the jitter.
+ * Only players count, spectators don't send inputs.
+ * */
+static uint32_t roomPickInputDelay(struct Room* room) {
+    if (room->input_delay_config != INPUT_DELAY_AUTO) return room->input_delay_config;
+
+    uint32_t farthest = 0;
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (!peer || !peer->conn.open || peer->role != ROLE_PLAYER || !peer->conn.stats.has_rtt) continue;
+
+        struct ConnStats* stats = &peer->conn.stats;
+        uint32_t one_way = stats->rtt/2 + (stats->rtt - stats->rtt_min);
+        if (one_way > farthest) farthest = one_way;
+    }
+
+    uint32_t ticks = (farthest + room->tick_time - 1) / room->tick_time;
+    return ticks < MAX_INPUT_DELAY ? ticks : MAX_INPUT_DELAY;
+}
+
+void roomStart(struct Room* room) {
+    room->running = true;
+    room->input_delay = roomPickInputDelay(room);
+
+    uint8_t data[START_GAME_SIZE];
+    startGameWrite(data, room->input_delay);
+    roomBroadcast(room, MSG_START_GAME, data, sizeof(data));
+}
+
+// Back to the lobby with the same players. Those that left stay out.
+void roomRestart(struct Room* room) {
+    struct GameState* game_state = room->game_state;
+
+    room->running = false;
+    reset(game_state);
+    room->local_inputs_size = 0;
+
+    for (size_t i = 0; i < game_state->players_size; i++) {
+        game_state->players[i].game_over = true;
+    }
+
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (!peer || !(peer->conn.open || peer->lost) || peer->role != ROLE_PLAYER) continue;
+
+        struct Player* player = &game_state->players[peer->player_i];
+        player->game_over = false;
+        // Clients keep counting from where they were
+        player->last_input_seq = peer->last_input_seq;
+        peer->inputs_size = 0;
+    }
+}
+
+/*
+ * A resuming connection takes the place of the lost one with its token,
+ * which may be in another room than the one it was accepted in, and gets the
+ * state right away instead of on the next tick. Too late and it watches.
+ * */
+static void roomsResumePeer(struct Room** rooms, size_t rooms_size, struct Room* room, size_t peer_i, uint32_t now) {
+    struct Peer* peer = room->peers[peer_i];
+
+    for (size_t r = 0; r < rooms_size; r++) {
+        for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+            struct Peer* lost = rooms[r]->peers[i];
+            if (!lost || !lost->lost || memcmp(lost->token, peer->token, SESSION_TOKEN_SIZE) != 0) continue;
+
+            peer->role = ROLE_PLAYER;
+            peer->player_i = lost->player_i;
+            memcpy(peer->inputs, lost->inputs, lost->inputs_size*sizeof(struct InputCmd));
+            peer->inputs_size = lost->inputs_size;
+            peer->last_input_seq = lost->last_input_seq;
+            peer->input_stats = lost->input_stats;
+
+            room->peers[peer_i] = NULL;
+            rooms[r]->peers[i] = peer;
+            free(lost);
+
+            roomSendWelcome(rooms[r], peer);
+            struct SharedBuf* full = NULL;
+            roomSendState(rooms[r], peer, &full, now);
+            if (full) sharedBufUnref(full);
+            return;
+        }
+    }
+
+    roomWelcome(room, peer, ROLE_SPECTATOR);
+}
+
+/*
+ * A spectator accepted in a lobby watches the first running match with a
+ * free slot instead, taking no place from players there. It stays when
+ * nothing is running.
+ * */
+static void roomsWatchPeer(struct Room** rooms, size_t rooms_size, struct Room* room, size_t peer_i) {
+    struct Peer* peer = room->peers[peer_i];
+
+    for (size_t r = 0; r < rooms_size && !room->running; r++) {
+        if (!rooms[r]->running) continue;
+
+        for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+            struct Peer* closed = rooms[r]->peers[i];
+            if (closed && (closed->conn.open || closed->lost)) continue;
+
+            free(closed);
+            room->peers[peer_i] = NULL;
+            rooms[r]->peers[i] = peer;
+
+            roomWelcome(rooms[r], peer, ROLE_SPECTATOR);
+            return;
+        }
+    }
+
+    roomWelcome(room, peer, ROLE_SPECTATOR);
+}
+
+void roomsResume(struct Room** rooms, size_t rooms_size, uint32_t now) {
+    for (size_t r = 0; r < rooms_size; r++) {
+        for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+            struct Peer* peer = rooms[r]->peers[i];
+            if (!peer || !peer->conn.open) continue;
+
+            if (peer->role == ROLE_RESUMING) {
+                roomsResumePeer(rooms, rooms_size, rooms[r], i, now);
+            } else if (peer->role == ROLE_WATCHING) {
+                roomsWatchPeer(rooms, rooms_size, rooms[r], i);
+            }
+        }
+    }
+}
+
+// Push queued bytes out without blocking
+void roomFlush(struct Room* room, uint32_t now) {
+    for (size_t i = 0; i < MAX_PEERS_SIZE; i++) {
+        struct Peer* peer = room->peers[i];
+        if (peer && peer->conn.open && !connFlush(&peer->conn, now)) {
+            roomPeerLost(room, peer, now);
+        }
+    }
+}
+
+void tickTimesAdd(struct TickTimes* tick_times, uint32_t time) {
+    if (tick_times->times_size < TICK_TIMES_SIZE) {
+        tick_times->times[tick_times->times_size++] = time;
+    }
+}
+
+static int compareU32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Once every STATS_PERIOD, summarize the ticks timed since the last one
+bool tickTimesStats(struct TickTimes* tick_times, uint32_t now, struct TickStats* stats) {
+    if (now - tick_times->period_start < STATS_PERIOD) return false;
+    tick_times->period_start = now;
+
+    size_t size = tick_times->times_size;
+    if (size == 0) return false;
+
+    qsort(tick_times->times, size, sizeof(uint32_t), compareU32);
+    stats->p50 = tick_times->times[size*50/100];
+    stats->p90 = tick_times->times[size*90/100];
+    stats->p99 = tick_times->times[size*99/100];
+    stats->max = tick_times->times[size-1];
+
+    tick_times->times_size = 0;
+    return true;
+}
@@ -0,0 +1,135 @@
+#ifndef ROOM_H
+#define ROOM_H
+
+#include "proto.h"
+
+#define MAX_SPECTATORS_SIZE 64
+#define MAX_PEERS_SIZE (MAX_PLAYERS_SIZE + MAX_SPECTATORS_SIZE)
+
+#define INPUT_QUEUE_SIZE 16
+// How many ticks ahead of the host a client may schedule an input
+#define MAX_INPUT_LEAD 60
+
+#define LOBBY_UPDATE_DELAY 100
+// A connection that hasn't sent MSG_JOIN or MSG_RESUME by then is closed, so
+// idle ones don't hold a slot
+#define JOIN_TIMEOUT 5000
+
+// Used to turn round trips into ticks until told otherwise
+#define DEFAULT_TICK_TIME (1000 / 60)
+
+// Players are sent what's this close to their head. It covers the whole
+// GRID_SIZE arena, so nothing is filtered unless it's lowered or the
+// arena grows.
+#define INTEREST_RADIUS 12
+
+/*
+ * A client whose connection can't take a state every tick gets one every
+ * snapshot_interval ticks instead, up to SNAPSHOT_MAX_INTERVAL, and past
+ * that a smaller area around its head, down to SNAPSHOT_MIN_RADIUS. It's
+ * backed up once what it hasn't taken would need SNAPSHOT_MAX_QUEUE_DELAY
+ * to get through, or its round trip grew that much over the lowest. Once it
+ * keeps up again, the detail comes back first.
+ * */
+#define SNAPSHOT_MAX_INTERVAL 4
+#define SNAPSHOT_MIN_RADIUS 6
+#define SNAPSHOT_MAX_QUEUE_DELAY 100
+
+// Ticks timed per STATS_PERIOD, more are ignored
+#define TICK_TIMES_SIZE 1024
+
+// How long a player's inputs took from being pressed to being applied
+struct InputDelayStats {
+    // Smoothed, in ms
+    uint32_t delay;
+    uint64_t applied;
+    // Applied after the tick they were scheduled for
+    uint64_t late;
+};
+
+// A connection to the host, from a player or a spectator
+struct Peer {
+    struct Conn conn;
+    enum Role role;
+    size_t player_i;
+    uint32_t accepted_at;
+
+    // Inputs waiting for their tick, oldest first
+    struct InputCmd inputs[INPUT_QUEUE_SIZE];
+    size_t inputs_size;
+    uint32_t last_input_seq;
+    struct InputDelayStats input_stats;
+
+    // Snapshot pacing, adapted once per STATS_PERIOD of the connection
+    uint32_t snapshot_interval;
+    uint32_t last_snapshot_tick;
+    int radius;
+    // Smoothed, in bytes
+    uint32_t snapshot_size;
+    uint32_t adapted_period;
+    uint64_t adapted_dropped;
+
+    uint8_t token[SESSION_TOKEN_SIZE];
+    // The connection is gone but the player may still resume
+    bool lost;
+    uint32_t lost_at;
+};
+
+// How long recent ticks took, in microseconds
+struct TickTimes {
+    uint32_t times[TICK_TIMES_SIZE];
+    size_t times_size;
+    uint32_t period_start;
+};
+
+/*
+ * The host side of one match: its players and spectators and the state they
+ * share. The game hosts one room, the dedicated server many.
+ * */
+struct Room {
+    struct GameState* game_state;
+    bool running;
+    int interest_radius;
+
+    // Ticks, or INPUT_DELAY_AUTO to pick it from the round trips each time
+    // the match starts
+    int input_delay_config;
+    uint32_t input_delay;
+    uint32_t tick_time;
+
+    // The host's own inputs, for player 0, when the host plays
+    struct InputCmd local_inputs[INPUT_QUEUE_SIZE];
+    size_t local_inputs_size;
+    struct InputDelayStats local_input_stats;
+
+    // Allocated when first needed and reused once closed, so the stats of
+    // a closed connection are kept until the next one takes its place
+    struct Peer* peers[MAX_PEERS_SIZE];
+
+    uint32_t last_lobby_update;
+};
+
+void roomInit(struct Room* room, struct GameState* game_state);
+void roomClose(struct Room* room);
+struct Peer* roomAccept(struct Room* room, int fd, uint32_t now);
+size_t roomPeersSize(struct Room* room);
+
+bool roomPeerWelcomed(struct Peer* peer);
+
+void roomRecv(struct Room* room, uint32_t now);
+void roomsResume(struct Room** rooms, size_t rooms_size, uint32_t now);
+void roomLocalInput(struct Room* room, enum Direction direc);
+void roomApplyInputs(struct Room* room);
+void roomBroadcast(struct Room* room, enum MsgType type, void* data, size_t data_size);
+void roomBroadcastState(struct Room* room, uint32_t now);
+bool roomPeerThrottled(struct Room* room, struct Peer* peer);
+void roomLobbyUpdate(struct Room* room, uint32_t now);
+bool roomRttsKnown(struct Room* room);
+void roomStart(struct Room* room);
+void roomRestart(struct Room* room);
+void roomFlush(struct Room* room, uint32_t now);
+
+void tickTimesAdd(struct TickTimes* tick_times, uint32_t time);
+bool tickTimesStats(struct TickTimes* tick_times, uint32_t now, struct TickStats* stats);
+
+#endif // ROOM_H
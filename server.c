@@ -0,0 +1,539 @@
+/*
+ * server: a dedicated host without a window, running many matches at once.
+ *
+ * Players are put in the first room still in its lobby. A room starts when
+ * it's full or when its first player has waited long enough, and goes back
+ * to its lobby once everyone is dead. Everyone connecting while all lobbies
+ * are taken watches a running match instead.
+ *
+ * Every STATS_PERIOD, how long the ticks took is sent to every client as
+ * MSG_TICK_STATS and printed, with the system calls and CPU time per tick.
+ *
+ * Sockets are read and written with a call each, woken up by poll for new
+ * connections, or through io_uring on Linux, see uring.h.
+ *
+ * With more than one worker on Linux, each is a process of its own pinned to
+ * a core, with its own rooms and its own listening socket on the same port
+ * (SO_REUSEPORT), so the kernel spreads new connections between them. A
+ * room stays with the worker its players were accepted by and nothing is
+ * shared between workers. A player resuming is only found again if its new
+ * connection lands on the same worker, otherwise it watches.
+ *
+ * Bots and clients on the same machine can connect through shared memory
+ * instead, on a local socket given with --local, see shm.h.
+ * */
+#if defined(__linux__)
+// poll, clock_gettime, sched_setaffinity
+#define _GNU_SOURCE
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "game.h"
+#include "proto.h"
+#include "room.h"
+#include "uring.h"
+#include "shm.h"
+
+#define GAME_OVER_DELAY 1000
+// Processes --workers may ask for
+#define MAX_WORKERS 1024
+
+struct ServerRoom {
+    struct Room room;
+    struct GameState game_state;
+
+    // When the first player of the lobby came in
+    uint32_t lobby_start;
+    // When the last player died, 0 while someone is alive
+    uint32_t game_over_start;
+};
+
+enum IoBackend {
+    IO_AUTO,
+    IO_POLL,
+    IO_URING,
+};
+
+struct Server {
+    int listen_fd;
+    // Not listening without --local
+    struct ShmListener local;
+    char* local_path;
+    size_t workers;
+    size_t worker_i;
+    enum IoBackend io;
+    // NULL when polling
+    struct Uring* ring;
+
+    struct ServerRoom* rooms;
+    // The same, for resumes that look through all rooms
+    struct Room** room_ptrs;
+    size_t rooms_size;
+
+    uint32_t tick_delay;
+    uint32_t lobby_timeout;
+    int interest_radius;
+    int input_delay;
+
+    struct TickTimes tick_times;
+    uint64_t period_ticks;
+    uint64_t period_syscalls;
+    uint64_t period_cpu_us;
+    uint64_t period_start_us;
+} server = {
+    .local = {.fd = -1},
+    .workers = 1,
+    .rooms_size = 16,
+    .tick_delay = 1000 / 60,
+    .lobby_timeout = 5000,
+    .interest_radius = INTEREST_RADIUS,
+    .input_delay = INPUT_DELAY_AUTO,
+    .io = IO_AUTO,
+};
+
+void usage(char* program) {
+    fprintf(stderr,
+        "usage: %s PORT [options]\n"
+        "\n"
+        "    --rooms N            matches hosted at once by each worker (default 16)\n"
+        "    --workers N          processes sharing the port, auto for one per core (default 1)\n"
+        "    --tick-rate HZ       game updates per second (default 60)\n"
+        "    --lobby-timeout MS   how long a lobby waits for more players (default 5000)\n"
+        "    --interest RADIUS    players are only sent what's this close to their head (default %d)\n"
+        "    --input-delay TICKS  how long every input waits, auto to fit the farthest player (default auto)\n"
+        "    --io BACKEND         poll, uring, or auto for uring when the system has it (default auto)\n"
+        "    --local PATH         also take clients on this machine through shared memory, on a socket at PATH\n"
+        "    --seed N\n",
+        program, INTEREST_RADIUS
+    );
+    exit(EXIT_FAILURE);
+}
+
+uint32_t parseNum(char* program, char* str, uint32_t min, uint32_t max) {
+    char* end;
+    long num = strtol(str, &end, 10);
+
+    if (*str == '\0' || *end != '\0' || num < (long)min || (unsigned long)num > max) {
+        fprintf(stderr, "Invalid number: %s\n", str);
+        usage(program);
+    }
+
+    return num;
+}
+
+void serverRoomInit(struct ServerRoom* server_room) {
+    memset(&server_room->game_state, 0, sizeof(server_room->game_state));
+    reset(&server_room->game_state);
+    server_room->game_state.players_size = 0;
+
+    roomInit(&server_room->room, &server_room->game_state);
+    server_room->room.interest_radius = server.interest_radius;
+    server_room->room.input_delay_config = server.input_delay;
+    server_room->room.tick_time = server.tick_delay;
+    server_room->lobby_start = 0;
+    server_room->game_over_start = 0;
+}
+
+// CPU time of the whole process, user and system
+uint64_t cpuNowUs() {
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#elif defined(WINDOWS)
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10;
+#endif // defined
+}
+
+/*
+ * Lobbies that still have a player's place come first, then running matches
+ * to watch, then anywhere with room. Whether it plays is only known once it
+ * joins, a spectator accepted in a lobby is moved to a running match then.
+ * NULL when it's full, not even to watch, and fd is closed.
+ * */
+struct Peer* serverPlace(int fd) {
+    struct ServerRoom* chosen = NULL;
+    for (size_t i = 0; i < server.rooms_size && !chosen; i++) {
+        struct Room* room = &server.rooms[i].room;
+        if (!room->running && room->game_state->players_size < MAX_PLAYERS_SIZE && roomPeersSize(room) < MAX_PEERS_SIZE) {
+            chosen = &server.rooms[i];
+        }
+    }
+    for (size_t i = 0; i < server.rooms_size && !chosen; i++) {
+        struct Room* room = &server.rooms[i].room;
+        if (room->running && roomPeersSize(room) < MAX_PEERS_SIZE) {
+            chosen = &server.rooms[i];
+        }
+    }
+    for (size_t i = 0; i < server.rooms_size && !chosen; i++) {
+        if (roomPeersSize(&server.rooms[i].room) < MAX_PEERS_SIZE) {
+            chosen = &server.rooms[i];
+        }
+    }
+
+    struct Peer* peer = chosen ? roomAccept(&chosen->room, fd, netNow()) : NULL;
+    if (!peer) closeFd(fd);
+    return peer;
+}
+
+void serverAddFd(int fd) {
+    struct Peer* peer = serverPlace(fd);
+    if (peer && server.ring && !uringAttach(server.ring, &peer->conn)) connClose(&peer->conn);
+}
+
+void serverAcceptLocal() {
+    struct ShmConn* shm;
+    while ((shm = shmAccept(&server.local))) {
+        struct Peer* peer = serverPlace(shm->fd);
+        if (peer) {
+            shmAttach(shm, &peer->conn);
+        } else {
+            shmFree(shm);
+        }
+    }
+}
+
+void serverAccept() {
+    while (true) {
+        int fd = accept(server.listen_fd, NULL, NULL);
+        net_syscalls++;
+        if (fd < 0) return;
+
+        serverAddFd(fd);
+    }
+}
+
+size_t roomPlayersAlive(struct Room* room) {
+    size_t alive = 0;
+    for (size_t i = 0; i < room->game_state->players_size; i++) {
+        if (!room->game_state->players[i].game_over) alive++;
+    }
+    return alive;
+}
+
+void serverRoomTick(struct ServerRoom* server_room, uint32_t now) {
+    struct Room* room = &server_room->room;
+    struct GameState* game_state = &server_room->game_state;
+
+    if (!room->running) {
+        roomLobbyUpdate(room, now);
+
+        if (game_state->players_size == 0) {
+            server_room->lobby_start = now;
+        } else if ((game_state->players_size == MAX_PLAYERS_SIZE && roomRttsKnown(room))
+                || now - server_room->lobby_start >= server.lobby_timeout) {
+            roomStart(room);
+        }
+    } else {
+        roomApplyInputs(room);
+        gameStateUpdate(game_state, now);
+        roomBroadcastState(room, now);
+
+        if (roomPlayersAlive(room) > 0) {
+            server_room->game_over_start = 0;
+        } else if (server_room->game_over_start == 0) {
+            server_room->game_over_start = now;
+        } else if (now - server_room->game_over_start >= GAME_OVER_DELAY) {
+            server_room->game_over_start = 0;
+            roomRestart(room);
+
+            // Nobody left to play, wait for new players
+            if (roomPlayersAlive(room) == 0) {
+                game_state->players_size = 0;
+            } else {
+                roomStart(room);
+            }
+        }
+    }
+
+    roomFlush(room, now);
+}
+
+void serverPrintStats(struct TickStats* stats, uint64_t now_us) {
+    size_t running = 0;
+    size_t conns = 0;
+    uint64_t bytes_out_rate = 0;
+    uint64_t inputs = 0;
+    uint64_t late = 0;
+    size_t throttled = 0;
+
+    for (size_t i = 0; i < server.rooms_size; i++) {
+        struct Room* room = &server.rooms[i].room;
+        if (room->running) running++;
+
+        for (size_t j = 0; j < MAX_PEERS_SIZE; j++) {
+            struct Peer* peer = room->peers[j];
+            if (!peer || !peer->conn.open) continue;
+
+            conns++;
+            bytes_out_rate += peer->conn.stats.bytes_out_rate;
+            if (roomPeerThrottled(room, peer)) throttled++;
+            inputs += peer->input_stats.applied;
+            late += peer->input_stats.late;
+        }
+    }
+
+    // Everything since the last print, waiting included
+    uint64_t ticks = server.period_ticks ? server.period_ticks : 1;
+    uint64_t syscalls = net_syscalls - server.period_syscalls;
+    uint64_t cpu_us = cpuNowUs();
+    uint64_t elapsed_us = now_us - server.period_start_us;
+    double cpu = elapsed_us ? (cpu_us - server.period_cpu_us) * 100.0 / elapsed_us : 0.0;
+
+    server.period_ticks = 0;
+    server.period_syscalls = net_syscalls;
+    server.period_cpu_us = cpu_us;
+    server.period_start_us = now_us;
+
+    if (server.workers > 1) printf("worker %zu: ", server.worker_i);
+    printf("%zu/%zu rooms running, %zu connections (%zu throttled), out %"PRIu64" KB/s, %"PRIu64"/%"PRIu64" inputs late, tick p50 %"PRIu32"us p90 %"PRIu32"us p99 %"PRIu32"us max %"PRIu32"us, %.1f syscalls/tick, cpu %.1f%%\n",
+        running, server.rooms_size, conns, throttled, bytes_out_rate / 1000, late, inputs, stats->p50, stats->p90, stats->p99, stats->max,
+        (double)syscalls / ticks, cpu);
+}
+
+// Wake up for new connections, or in time for the next tick
+void serverWait(uint32_t timeout) {
+#if defined(__linux__)
+    struct pollfd pfd = {.fd = server.listen_fd, .events = POLLIN};
+    poll(&pfd, 1, timeout);
+    net_syscalls++;
+#elif defined(WINDOWS)
+    WSAPOLLFD pfd = {.fd = server.listen_fd, .events = POLLRDNORM};
+    WSAPoll(&pfd, 1, timeout);
+#endif
+}
+
+// Every worker listens on the same port with a socket of its own
+void serverListen(uint16_t port) {
+    server.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    pcr(server.listen_fd, "Socket creation failed");
+
+#if defined(__linux__)
+    if (server.workers > 1) {
+        int on = 1;
+        pcr(setsockopt(server.listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)), "SO_REUSEPORT failed");
+    }
+#endif // defined
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    pcr(bind(server.listen_fd, (struct sockaddr*)&addr, sizeof(addr)), "Bind failed");
+    pcr(listen(server.listen_fd, SOMAXCONN), "Listening failed");
+    unblock(server.listen_fd);
+}
+
+// Hosts matches until the process is stopped
+void serverRun(uint16_t port, unsigned seed) {
+    srand(seed);
+
+    server.rooms = pcp(calloc(server.rooms_size, sizeof(struct ServerRoom)), "calloc failed");
+    server.room_ptrs = pcp(calloc(server.rooms_size, sizeof(struct Room*)), "calloc failed");
+    for (size_t i = 0; i < server.rooms_size; i++) {
+        serverRoomInit(&server.rooms[i]);
+        server.room_ptrs[i] = &server.rooms[i].room;
+    }
+
+    serverListen(port);
+
+    if (server.local_path) {
+        // Unix sockets can't share a path, each worker has its own
+        char path[256];
+        if (server.workers > 1) {
+            snprintf(path, sizeof(path), "%s.%zu", server.local_path, server.worker_i);
+        } else {
+            snprintf(path, sizeof(path), "%s", server.local_path);
+        }
+
+        if (!shmListen(&server.local, path)) {
+            fprintf(stderr, "Local socket failed: %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (server.io != IO_POLL) {
+        server.ring = uringInit(server.rooms_size*MAX_PEERS_SIZE, server.listen_fd, serverAddFd);
+        if (!server.ring && server.io == IO_URING) {
+            fprintf(stderr, "io_uring isn't available\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (server.workers > 1) printf("worker %zu: ", server.worker_i);
+    printf("Listening on %"PRIu16", %zu rooms, %s (seed %u)\n", port, server.rooms_size, server.ring ? "io_uring" : "poll", seed);
+
+    uint32_t next_tick = netNow();
+    server.period_start_us = netNowUs();
+    server.period_cpu_us = cpuNowUs();
+
+    while (true) {
+        uint32_t now = netNow();
+        if ((int32_t)(next_tick - now) > 0) {
+            if (server.ring) {
+                uringWait(server.ring, next_tick - now);
+            } else {
+                serverWait(next_tick - now);
+                serverAccept();
+            }
+            continue;
+        }
+
+        // Don't try to catch up on ticks missed while overloaded
+        next_tick += server.tick_delay;
+        if ((int32_t)(now - next_tick) > 0) next_tick = now;
+
+        uint64_t tick_start = netNowUs();
+
+        if (server.local.fd >= 0) serverAcceptLocal();
+        for (size_t i = 0; i < server.rooms_size; i++) {
+            roomRecv(&server.rooms[i].room, now);
+        }
+        roomsResume(server.room_ptrs, server.rooms_size, now);
+
+        for (size_t i = 0; i < server.rooms_size; i++) {
+            serverRoomTick(&server.rooms[i], now);
+        }
+        if (server.ring) uringFlush(server.ring);
+
+        tickTimesAdd(&server.tick_times, netNowUs() - tick_start);
+        server.period_ticks++;
+
+        struct TickStats stats;
+        if (tickTimesStats(&server.tick_times, now, &stats)) {
+            uint8_t data[TICK_STATS_SIZE];
+            tickStatsWrite(data, &stats);
+            for (size_t i = 0; i < server.rooms_size; i++) {
+                roomBroadcast(&server.rooms[i].room, MSG_TICK_STATS, data, sizeof(data));
+            }
+
+            serverPrintStats(&stats, netNowUs());
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) usage(argv[0]);
+
+    uint16_t port = parseNum(argv[0], argv[1], 1, UINT16_MAX);
+    unsigned seed = netNow();
+
+#if defined(__linux__)
+    // Online cores, one when the system can't tell
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+#endif // defined
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+
+        char* opt = argv[i];
+        char* value = argv[++i];
+
+        if (strcmp(opt, "--rooms") == 0) {
+            server.rooms_size = parseNum(argv[0], value, 1, 4096);
+        } else if (strcmp(opt, "--workers") == 0) {
+#if defined(__linux__)
+            if (strcmp(value, "auto") == 0) {
+                server.workers = cores < MAX_WORKERS ? cores : MAX_WORKERS;
+            } else {
+                server.workers = parseNum(argv[0], value, 1, MAX_WORKERS);
+            }
+#else
+            fprintf(stderr, "Workers are only available on Linux\n");
+            usage(argv[0]);
+#endif // defined
+        } else if (strcmp(opt, "--tick-rate") == 0) {
+            server.tick_delay = 1000 / parseNum(argv[0], value, 1, 1000);
+        } else if (strcmp(opt, "--lobby-timeout") == 0) {
+            server.lobby_timeout = parseNum(argv[0], value, 0, 600000);
+        } else if (strcmp(opt, "--interest") == 0) {
+            server.interest_radius = parseNum(argv[0], value, 0, GRID_SIZE);
+        } else if (strcmp(opt, "--input-delay") == 0) {
+            if (strcmp(value, "auto") == 0) {
+                server.input_delay = INPUT_DELAY_AUTO;
+            } else {
+                server.input_delay = parseNum(argv[0], value, 0, MAX_INPUT_DELAY);
+            }
+        } else if (strcmp(opt, "--io") == 0) {
+            if (strcmp(value, "auto") == 0) {
+                server.io = IO_AUTO;
+            } else if (strcmp(value, "poll") == 0) {
+                server.io = IO_POLL;
+            } else if (strcmp(value, "uring") == 0) {
+                server.io = IO_URING;
+            } else {
+                fprintf(stderr, "Unknown I/O backend: %s\n", value);
+                usage(argv[0]);
+            }
+        } else if (strcmp(opt, "--local") == 0) {
+            server.local_path = value;
+        } else if (strcmp(opt, "--seed") == 0) {
+            seed = parseNum(argv[0], value, 0, UINT32_MAX);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", opt);
+            usage(argv[0]);
+        }
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+#ifdef WINDOWS
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != NO_ERROR) {
+        fprintf(stderr, "WSAStartup failed: %d\n", WSAGetLastError());
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+#if defined(__linux__)
+    if (server.workers > 1) {
+        pid_t* pids = pcp(calloc(server.workers, sizeof(pid_t)), "calloc failed");
+
+        for (size_t i = 0; i < server.workers; i++) {
+            pids[i] = pcr(fork(), "fork failed");
+            if (pids[i] > 0) continue;
+
+            server.worker_i = i;
+            // Stopping the server stops its workers
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(i % cores, &cpu_set);
+            sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+
+            serverRun(port, seed + i);
+        }
+
+        // Workers only stop when something went wrong, the others go too
+        pid_t stopped = wait(NULL);
+        for (size_t i = 0; i < server.workers; i++) {
+            if (pids[i] != stopped) kill(pids[i], SIGTERM);
+        }
+        while (wait(NULL) > 0);
+
+        fprintf(stderr, "A worker stopped\n");
+        exit(EXIT_FAILURE);
+    }
+#endif // defined
+
+    serverRun(port, seed);
+}
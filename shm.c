@@ -0,0 +1,406 @@
+#if defined(__linux__)
+// memfd_create, accept4
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+
+#include "shm.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+static void ringWake(struct ShmRing* ring, int event) {
+    // Against the reader's store to waiting before it checks tail
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED)) {
+        uint64_t one = 1;
+        if (write(event, &one, sizeof(one)) < 0) {}
+        net_syscalls++;
+    }
+}
+
+/*
+ * The other process can write anything to head and tail, so they're read
+ * once each and -1 is returned if they can't be right, rather than copying
+ * out of the ring.
+ * */
+static int ringWrite(struct ShmRing* ring, uint8_t* data, size_t data_size) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (tail - head > SHM_RING_SIZE) return -1;
+
+    size_t free_size = SHM_RING_SIZE - (tail - head);
+    if (data_size > free_size) data_size = free_size;
+
+    size_t off = tail & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - off;
+    if (first > data_size) first = data_size;
+
+    memcpy(&ring->data[off], data, first);
+    memcpy(ring->data, &data[first], data_size - first);
+
+    __atomic_store_n(&ring->tail, tail + data_size, __ATOMIC_RELEASE);
+    return data_size;
+}
+
+static int ringRead(struct ShmRing* ring, uint8_t* buff, size_t buff_size) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (tail - head > SHM_RING_SIZE) return -1;
+
+    size_t size = tail - head;
+    if (size > buff_size) size = buff_size;
+
+    size_t off = head & (SHM_RING_SIZE - 1);
+    size_t first = SHM_RING_SIZE - off;
+    if (first > size) first = size;
+
+    memcpy(buff, &ring->data[off], first);
+    memcpy(&buff[first], ring->data, size - first);
+
+    __atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+    return size;
+}
+
+static int shmConnWrite(void* ctx, uint8_t* data, size_t data_size) {
+    struct ShmConn* shm = ctx;
+    if (__atomic_load_n(&shm->in->closed, __ATOMIC_ACQUIRE)) return -1;
+
+    int written = ringWrite(shm->out, data, data_size);
+    if (written > 0) ringWake(shm->out, shm->out_event);
+    return written;
+}
+
+static int shmConnRead(void* ctx, uint8_t* buff, size_t buff_size) {
+    struct ShmConn* shm = ctx;
+
+    int size = ringRead(shm->in, buff, buff_size);
+    if (size < 0) return -1;
+
+    uint32_t now = netNow();
+    if (size > 0) {
+        shm->last_recv = now;
+        return size;
+    }
+
+    if (__atomic_load_n(&shm->in->closed, __ATOMIC_ACQUIRE)) return -1;
+
+    // It may have gone without saying so
+    if (now - shm->last_recv >= SHM_IDLE_CHECK) {
+        shm->last_recv = now;
+
+        uint8_t byte;
+        ssize_t ret = recv(shm->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        net_syscalls++;
+        if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) return -1;
+    }
+
+    return 0;
+}
+
+static void shmConnClose(void* ctx) {
+    struct ShmConn* shm = ctx;
+
+    __atomic_store_n(&shm->out->closed, 1, __ATOMIC_RELEASE);
+    ringWake(shm->out, shm->out_event);
+    shmFree(shm);
+}
+
+static const struct ConnIo shm_conn_io = {
+    .write = shmConnWrite,
+    .read = shmConnRead,
+    .close = shmConnClose,
+};
+
+static bool shmAddr(char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return false;
+
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+// Non blocking. A socket file left at path is replaced.
+bool shmListen(struct ShmListener* listener, char* path) {
+    memset(listener, 0, sizeof(*listener));
+    listener->fd = -1;
+
+    struct sockaddr_un addr;
+    if (!shmAddr(path, &addr)) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        closeFd(fd);
+        return false;
+    }
+
+    unblock(fd);
+    listener->fd = fd;
+    return true;
+}
+
+/*
+ * The host only maps a segment the client can't shrink anymore, touching
+ * pages past its end would take the host down with SIGBUS.
+ * */
+static struct ShmConn* shmMap(int fd, int memfd, int in_event, int out_event, bool host) {
+    if (host) {
+        struct stat st;
+        int seals = fcntl(memfd, F_GET_SEALS);
+        if (fstat(memfd, &st) < 0 || st.st_size < (off_t)sizeof(struct ShmSegment)
+                || seals < 0 || !(seals & F_SEAL_SHRINK)) {
+            fprintf(stderr, "Local client's segment is too small or can shrink\n");
+            return NULL;
+        }
+    }
+
+    struct ShmSegment* segment = mmap(NULL, sizeof(struct ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (segment == MAP_FAILED) return NULL;
+
+    struct ShmConn* shm = pcp(calloc(1, sizeof(*shm)), "calloc failed");
+    shm->segment = segment;
+    shm->in = host ? &segment->to_host : &segment->to_client;
+    shm->out = host ? &segment->to_client : &segment->to_host;
+    shm->in_event = in_event;
+    shm->out_event = out_event;
+    shm->fd = fd;
+    shm->last_recv = netNow();
+    return shm;
+}
+
+/*
+ * The segment, then the client's and the host's eventfd. 1 once they came,
+ * 0 while they haven't yet and -1 if something else did.
+ * */
+static int shmHandshake(int fd, int fds[3]) {
+    uint8_t byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union {
+        struct cmsghdr header;
+        uint8_t buff[CMSG_SPACE(3*sizeof(int))];
+    } control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buff;
+    msg.msg_controllen = sizeof(control.buff);
+
+    ssize_t ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    net_syscalls++;
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+
+    struct cmsghdr* cmsg = ret == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3*sizeof(int))) {
+        // Whatever came along with it is closed too
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t fds_size = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < fds_size; i++) {
+                int extra;
+                memcpy(&extra, CMSG_DATA(cmsg) + i*sizeof(int), sizeof(int));
+                closeFd(extra);
+            }
+        }
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), 3*sizeof(int));
+    return 1;
+}
+
+/*
+ * A client that sent its segment, NULL when there's none yet. New clients
+ * are accepted without waiting for it, it's looked for again on the next
+ * call, and they're dropped if it doesn't come within SHM_HANDSHAKE_TIMEOUT.
+ * */
+struct ShmConn* shmAccept(struct ShmListener* listener) {
+    uint32_t now = netNow();
+
+    while (true) {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        net_syscalls++;
+        if (fd < 0) break;
+
+        if (listener->pending_size == SHM_PENDING_SIZE) {
+            fprintf(stderr, "Too many local clients connecting, dropping one\n");
+            closeFd(fd);
+            continue;
+        }
+        listener->pending[listener->pending_size] = fd;
+        listener->pending_since[listener->pending_size] = now;
+        listener->pending_size++;
+    }
+
+    for (size_t i = 0; i < listener->pending_size; i++) {
+        int fd = listener->pending[i];
+
+        int fds[3];
+        int ret = shmHandshake(fd, fds);
+        if (ret == 0 && now - listener->pending_since[i] < SHM_HANDSHAKE_TIMEOUT) continue;
+
+        // Done with, either way
+        listener->pending_size--;
+        listener->pending[i] = listener->pending[listener->pending_size];
+        listener->pending_since[i] = listener->pending_since[listener->pending_size];
+        i--;
+
+        if (ret <= 0) {
+            fprintf(stderr, "Local client sent no segment\n");
+            closeFd(fd);
+            continue;
+        }
+
+        struct ShmConn* shm = shmMap(fd, fds[0], fds[2], fds[1], true);
+        closeFd(fds[0]);
+        if (!shm) {
+            closeFd(fds[1]);
+            closeFd(fds[2]);
+            closeFd(fd);
+            continue;
+        }
+        return shm;
+    }
+
+    return NULL;
+}
+
+// Connect to a host's local socket at path, NULL if it failed
+struct ShmConn* shmConnect(char* path) {
+    struct sockaddr_un addr;
+    if (!shmAddr(path, &addr)) return NULL;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        closeFd(fd);
+        return NULL;
+    }
+
+    // Zeroed, which is both rings empty
+    int memfd = memfd_create("snake_battle", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int in_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int out_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct ShmConn* shm = NULL;
+    if (memfd >= 0 && in_event >= 0 && out_event >= 0 && ftruncate(memfd, sizeof(struct ShmSegment)) == 0
+            && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0) {
+        shm = shmMap(fd, memfd, in_event, out_event, false);
+    }
+
+    if (shm) {
+        int fds[3] = {memfd, in_event, out_event};
+        uint8_t byte = 0;
+        struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+        union {
+            struct cmsghdr header;
+            uint8_t buff[CMSG_SPACE(sizeof(fds))];
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buff;
+        msg.msg_controllen = sizeof(control.buff);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (sendmsg(fd, &msg, 0) != 1) {
+            shmFree(shm);
+            shm = NULL;
+        }
+    } else {
+        if (in_event >= 0) closeFd(in_event);
+        if (out_event >= 0) closeFd(out_event);
+    }
+
+    if (memfd >= 0) closeFd(memfd);
+    if (!shm) closeFd(fd);
+    return shm;
+}
+
+// The connection goes through shm from now on, and frees it when closed
+void shmAttach(struct ShmConn* shm, struct Conn* conn) {
+    connSetIo(conn, &shm_conn_io, shm);
+}
+
+// Doesn't close the local socket, that's the connection's
+void shmFree(struct ShmConn* shm) {
+    munmap(shm->segment, sizeof(struct ShmSegment));
+    closeFd(shm->in_event);
+    closeFd(shm->out_event);
+    free(shm);
+}
+
+bool shmWaitStart(struct ShmConn* shm) {
+    __atomic_store_n(&shm->in->waiting, 1, __ATOMIC_RELAXED);
+    // Against the writer's store to tail before it checks waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&shm->in->tail, __ATOMIC_RELAXED) == shm->in->head
+        && !__atomic_load_n(&shm->in->closed, __ATOMIC_RELAXED);
+}
+
+// Woken when in_event was signalled, which clears it
+void shmWaitEnd(struct ShmConn* shm, bool woken) {
+    __atomic_store_n(&shm->in->waiting, 0, __ATOMIC_RELAXED);
+    if (!woken) return;
+
+    uint64_t count;
+    if (read(shm->in_event, &count, sizeof(count)) < 0) {}
+    net_syscalls++;
+}
+
+#else
+
+bool shmListen(struct ShmListener* listener, char* path) {
+    (void)path;
+    listener->fd = -1;
+    listener->pending_size = 0;
+    return false;
+}
+
+struct ShmConn* shmAccept(struct ShmListener* listener) {
+    (void)listener;
+    return NULL;
+}
+
+struct ShmConn* shmConnect(char* path) {
+    (void)path;
+    return NULL;
+}
+
+void shmAttach(struct ShmConn* shm, struct Conn* conn) {
+    (void)shm;
+    (void)conn;
+}
+
+void shmFree(struct ShmConn* shm) {
+    (void)shm;
+}
+
+bool shmWaitStart(struct ShmConn* shm) {
+    (void)shm;
+    return false;
+}
+
+void shmWaitEnd(struct ShmConn* shm, bool woken) {
+    (void)shm;
+    (void)woken;
+}
+
+#endif // defined
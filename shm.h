@@ -0,0 +1,73 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "net.h"
+
+// Each way, a power of two. A few states' worth, so a client that doesn't
+// keep up backs up the host like a socket would.
+#define SHM_RING_SIZE (64*1024)
+// How long a connection may send nothing before its socket is checked
+#define SHM_IDLE_CHECK 1000
+// Local clients connected that haven't sent their segment yet, and how long
+// the host waits for it
+#define SHM_PENDING_SIZE 256
+#define SHM_HANDSHAKE_TIMEOUT 1000
+
+/*
+ * Connections between processes on the same machine through shared memory,
+ * Linux only.
+ *
+ * The client maps a segment with a ring each way and connects to the host's
+ * local socket, handing it the segment and an eventfd per ring. Messages
+ * then go through the rings only, with the local socket kept to notice the
+ * other process going away. Each ring has a single writer and a single
+ * reader, so head and tail are all they share, and the writer only makes a
+ * call to wake the reader up when it said it was going to sleep.
+ * */
+struct ShmRing {
+    // Written by the reader
+    _Alignas(64) uint32_t head;
+    uint32_t waiting;
+    // Written by the writer
+    _Alignas(64) uint32_t tail;
+    uint32_t closed;
+    _Alignas(64) uint8_t data[SHM_RING_SIZE];
+};
+
+struct ShmSegment {
+    struct ShmRing to_host;
+    struct ShmRing to_client;
+};
+
+struct ShmConn {
+    struct ShmSegment* segment;
+    struct ShmRing* in;
+    struct ShmRing* out;
+    // Signalled when in, or out, has something for a reader that waits
+    int in_event;
+    int out_event;
+
+    int fd;
+    uint32_t last_recv;
+};
+
+struct ShmListener {
+    // -1 when not listening
+    int fd;
+    int pending[SHM_PENDING_SIZE];
+    uint32_t pending_since[SHM_PENDING_SIZE];
+    size_t pending_size;
+};
+
+bool shmListen(struct ShmListener* listener, char* path);
+struct ShmConn* shmAccept(struct ShmListener* listener);
+struct ShmConn* shmConnect(char* path);
+void shmAttach(struct ShmConn* shm, struct Conn* conn);
+void shmFree(struct ShmConn* shm);
+
+// Before and after waiting for in_event, false when there's already
+// something to read
+bool shmWaitStart(struct ShmConn* shm);
+void shmWaitEnd(struct ShmConn* shm, bool woken);
+
+#endif // SHM_H
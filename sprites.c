@@ -0,0 +1,128 @@
+#include <string.h>
+
+#include "sprites.h"
+
+#if defined(__linux__)
+#include <SDL2/SDL_image.h>
+#else
+#include <SDL_image.h>
+#endif
+
+// Scaled to tile_size, NULL if it can't be loaded
+static SDL_Surface* loadTile(char* path, int tile_size) {
+    SDL_Surface* image = IMG_Load(path);
+    if (!image) return NULL;
+
+    SDL_Surface* tile = SDL_CreateRGBSurfaceWithFormat(0, tile_size, tile_size, 32, SDL_PIXELFORMAT_RGBA32);
+    if (tile) {
+        SDL_SetSurfaceBlendMode(image, SDL_BLENDMODE_NONE);
+        SDL_BlitScaled(image, NULL, tile, NULL);
+    }
+
+    SDL_FreeSurface(image);
+    return tile;
+}
+
+static uint32_t* pixelAt(SDL_Surface* surf, int x, int y) {
+    return (uint32_t*)((uint8_t*)surf->pixels + y*surf->pitch) + x;
+}
+
+/*
+ * A tile copied into the atlas at (x0, y0), turned clockwise by
+ * quarter_turns and multiplied by tint.
+ * */
+static void copyTile(SDL_Surface* atlas, SDL_Surface* tile, int x0, int y0, int quarter_turns, SDL_Color tint) {
+    int n = tile->w;
+
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            int src_x;
+            int src_y;
+            switch (quarter_turns) {
+            case 1: {
+                src_x = y;
+                src_y = n - 1 - x;
+            } break;
+            case 2: {
+                src_x = n - 1 - x;
+                src_y = n - 1 - y;
+            } break;
+            case 3: {
+                src_x = n - 1 - y;
+                src_y = x;
+            } break;
+            default: {
+                src_x = x;
+                src_y = y;
+            } break;
+            }
+
+            uint8_t r, g, b, a;
+            SDL_GetRGBA(*pixelAt(tile, src_x, src_y), tile->format, &r, &g, &b, &a);
+            r = r*tint.r/0xFF;
+            g = g*tint.g/0xFF;
+            b = b*tint.b/0xFF;
+            *pixelAt(atlas, x0 + x, y0 + y) = SDL_MapRGBA(atlas->format, r, g, b, a);
+        }
+    }
+}
+
+/*
+ * Heads are turned from head_path's, which faces up. tints has a colour per
+ * player, white keeps the sprites as they are.
+ * */
+bool spriteAtlasInit(struct SpriteAtlas* atlas, SDL_Renderer* renderer, char* head_path, char* body_path, int tile_size, SDL_Color* tints) {
+    bool ret = true;
+    memset(atlas, 0, sizeof(*atlas));
+
+    SDL_Surface* head = loadTile(head_path, tile_size);
+    SDL_Surface* body = loadTile(body_path, tile_size);
+    SDL_Surface* surf = SDL_CreateRGBSurfaceWithFormat(0, SPRITES_SIZE*tile_size, MAX_PLAYERS_SIZE*tile_size, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!head || !body || !surf) {
+        ret = false;
+        goto defer;
+    }
+
+    SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+    for (size_t p = 0; p < MAX_PLAYERS_SIZE; p++) {
+        for (size_t i = 0; i < SPRITES_SIZE; i++) {
+            atlas->sprites[p][i] = (SDL_Rect){.x = i*tile_size, .y = p*tile_size, .w = tile_size, .h = tile_size};
+        }
+
+        SDL_Rect* white_rect = &atlas->sprites[p][SPRITE_WHITE];
+        SDL_FillRect(surf, white_rect, SDL_MapRGBA(surf->format, 0xFF, 0xFF, 0xFF, 0xFF));
+        // Only the middle is sampled, away from the neighbours' edges
+        white_rect->x += tile_size/4;
+        white_rect->y += tile_size/4;
+        white_rect->w = tile_size/2;
+        white_rect->h = tile_size/2;
+
+        SDL_Rect* body_rect = &atlas->sprites[p][SPRITE_BODY];
+        copyTile(surf, body, body_rect->x, body_rect->y, 0, tints ? tints[p] : white);
+
+        // Quarter turns clockwise for each of enum Direction
+        int turns[4] = {[DOWN] = 2, [LEFT] = 3, [RIGHT] = 1, [UP] = 0};
+        for (size_t d = 0; d < 4; d++) {
+            SDL_Rect* head_rect = &atlas->sprites[p][SPRITE_HEAD + d];
+            copyTile(surf, head, head_rect->x, head_rect->y, turns[d], tints ? tints[p] : white);
+        }
+    }
+
+    atlas->texture = SDL_CreateTextureFromSurface(renderer, surf);
+    if (!atlas->texture) {
+        ret = false;
+        goto defer;
+    }
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+
+defer:
+    if (head) SDL_FreeSurface(head);
+    if (body) SDL_FreeSurface(body);
+    if (surf) SDL_FreeSurface(surf);
+    return ret;
+}
+
+void spriteAtlasFree(struct SpriteAtlas* atlas) {
+    if (atlas->texture) SDL_DestroyTexture(atlas->texture);
+    atlas->texture = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef SPRITES_H
+#define SPRITES_H
+
+#include <stdbool.h>
+
+#include "game.h"
+
+#if defined(__linux__)
+#include <SDL2/SDL.h>
+#else
+#include <SDL.h>
+#endif
+
+/*
+ * Heads come turned every way, in the order of enum Direction, so none has
+ * to be rotated when it's drawn. White is a plain tile for filling cells
+ * with a colour from the same texture.
+ * */
+enum Sprite {
+    SPRITE_WHITE,
+    SPRITE_BODY,
+    SPRITE_HEAD,
+    SPRITES_SIZE = SPRITE_HEAD + 4,
+};
+
+/*
+ * Every sprite on the board in one texture, scaled to the size it's drawn
+ * at, so the whole board can go out in a single draw call. Each player has
+ * a row of their own, tinted with their colour.
+ * */
+struct SpriteAtlas {
+    SDL_Texture* texture;
+    SDL_Rect sprites[MAX_PLAYERS_SIZE][SPRITES_SIZE];
+};
+
+bool spriteAtlasInit(struct SpriteAtlas* atlas, SDL_Renderer* renderer, char* head_path, char* body_path, int tile_size, SDL_Color* tints);
+void spriteAtlasFree(struct SpriteAtlas* atlas);
+
+#endif // SPRITES_H
@@ -0,0 +1,204 @@
+#include <string.h>
+
+#include "text.h"
+
+// Quads drawn with one call, longer strings take more
+#define GLYPH_BATCH_SIZE 64
+
+static size_t glyphIndex(char c) {
+    if (c < GLYPH_FIRST || c > GLYPH_LAST) c = '?';
+    return c - GLYPH_FIRST;
+}
+
+bool glyphAtlasInit(struct GlyphAtlas* atlas, SDL_Renderer* renderer, TTF_Font* font) {
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->font = font;
+    atlas->height = TTF_FontHeight(font);
+
+    SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+    SDL_Surface* surfs[GLYPHS_SIZE];
+
+    // Laid out in rows first, to know how tall the atlas is
+    int x = 0;
+    int y = 0;
+    for (size_t i = 0; i < GLYPHS_SIZE; i++) {
+        uint16_t ch = GLYPH_FIRST + i;
+
+        int advance = 0;
+        TTF_GlyphMetrics(font, ch, NULL, NULL, NULL, NULL, &advance);
+        atlas->advances[i] = advance;
+        for (size_t j = 0; j < GLYPHS_SIZE; j++) {
+            atlas->kerning[i][j] = TTF_GetFontKerningSizeGlyphs(font, ch, GLYPH_FIRST + j);
+        }
+
+        // Nothing to draw for a space
+        surfs[i] = TTF_RenderGlyph_Solid(font, ch, white);
+        if (!surfs[i]) continue;
+
+        if (x + surfs[i]->w > GLYPH_ATLAS_WIDTH) {
+            x = 0;
+            y += atlas->height;
+        }
+        atlas->glyphs[i] = (SDL_Rect){.x = x, .y = y, .w = surfs[i]->w, .h = surfs[i]->h};
+        x += surfs[i]->w;
+    }
+
+    atlas->texture_w = GLYPH_ATLAS_WIDTH;
+    atlas->texture_h = y + atlas->height;
+
+    SDL_Surface* surf = SDL_CreateRGBSurfaceWithFormat(0, atlas->texture_w, atlas->texture_h, 32, SDL_PIXELFORMAT_RGBA32);
+    if (surf) {
+        // Transparent where the glyphs aren't
+        SDL_FillRect(surf, NULL, SDL_MapRGBA(surf->format, 0xFF, 0xFF, 0xFF, 0));
+
+        for (size_t i = 0; i < GLYPHS_SIZE; i++) {
+            if (!surfs[i]) continue;
+
+            SDL_SetSurfaceBlendMode(surfs[i], SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(surfs[i], NULL, surf, &atlas->glyphs[i]);
+        }
+
+        atlas->texture = SDL_CreateTextureFromSurface(renderer, surf);
+        SDL_FreeSurface(surf);
+    }
+
+    for (size_t i = 0; i < GLYPHS_SIZE; i++) {
+        if (surfs[i]) SDL_FreeSurface(surfs[i]);
+    }
+
+    if (!atlas->texture) return false;
+
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+    return true;
+}
+
+void glyphAtlasFree(struct GlyphAtlas* atlas) {
+    if (atlas->texture) SDL_DestroyTexture(atlas->texture);
+    atlas->texture = NULL;
+}
+
+// Like TTF_SizeText, without laying the string out again
+void glyphAtlasSize(struct GlyphAtlas* atlas, char* text, int* w, int* h) {
+    int x = 0;
+    size_t prev = GLYPHS_SIZE;
+    for (char* c = text; *c != '\0'; c++) {
+        size_t i = glyphIndex(*c);
+        if (prev < GLYPHS_SIZE) x += atlas->kerning[prev][i];
+
+        x += atlas->advances[i];
+        prev = i;
+    }
+
+    if (w) *w = x;
+    if (h) *h = atlas->height;
+}
+
+void glyphAtlasDraw(struct GlyphAtlas* atlas, SDL_Renderer* renderer, char* text, int x, int y, SDL_Color color) {
+    SDL_Vertex vertices[4*GLYPH_BATCH_SIZE];
+    int indices[6*GLYPH_BATCH_SIZE];
+    size_t quads = 0;
+
+    float tex_w = atlas->texture_w;
+    float tex_h = atlas->texture_h;
+
+    size_t prev = GLYPHS_SIZE;
+    for (char* c = text; *c != '\0'; c++) {
+        size_t i = glyphIndex(*c);
+        if (prev < GLYPHS_SIZE) x += atlas->kerning[prev][i];
+
+        SDL_Rect* src = &atlas->glyphs[i];
+        if (src->w > 0) {
+            SDL_Vertex* v = &vertices[4*quads];
+            float x0 = x;
+            float y0 = y;
+            float x1 = x + src->w;
+            float y1 = y + src->h;
+            float u0 = src->x / tex_w;
+            float v0 = src->y / tex_h;
+            float u1 = (src->x + src->w) / tex_w;
+            float v1 = (src->y + src->h) / tex_h;
+
+            v[0] = (SDL_Vertex){{x0, y0}, color, {u0, v0}};
+            v[1] = (SDL_Vertex){{x1, y0}, color, {u1, v0}};
+            v[2] = (SDL_Vertex){{x1, y1}, color, {u1, v1}};
+            v[3] = (SDL_Vertex){{x0, y1}, color, {u0, v1}};
+
+            int* idx = &indices[6*quads];
+            int first = 4*quads;
+            idx[0] = first;
+            idx[1] = first + 1;
+            idx[2] = first + 2;
+            idx[3] = first;
+            idx[4] = first + 2;
+            idx[5] = first + 3;
+
+            quads++;
+            if (quads == GLYPH_BATCH_SIZE) {
+                SDL_RenderGeometry(renderer, atlas->texture, vertices, 4*quads, indices, 6*quads);
+                quads = 0;
+            }
+        }
+
+        x += atlas->advances[i];
+        prev = i;
+    }
+
+    if (quads > 0) {
+        SDL_RenderGeometry(renderer, atlas->texture, vertices, 4*quads, indices, 6*quads);
+    }
+}
+
+/*
+ * The string's texture, made now if it isn't cached yet. NULL if it's too
+ * long to be cached or couldn't be made, for the caller to draw it from the
+ * atlas instead.
+ * */
+struct CachedText* textCacheGet(struct TextCache* cache, SDL_Renderer* renderer, struct GlyphAtlas* atlas, char* text, SDL_Color color) {
+    if (strlen(text) >= CACHED_TEXT_SIZE) return NULL;
+
+    cache->uses++;
+
+    struct CachedText* oldest = &cache->entries[0];
+    for (size_t i = 0; i < TEXT_CACHE_SIZE; i++) {
+        struct CachedText* entry = &cache->entries[i];
+
+        if (entry->texture && entry->atlas == atlas && strcmp(entry->text, text) == 0
+                && entry->color.r == color.r && entry->color.g == color.g
+                && entry->color.b == color.b && entry->color.a == color.a) {
+            entry->last_used = cache->uses;
+            return entry;
+        }
+
+        if (!entry->texture) {
+            oldest = entry;
+            oldest->last_used = 0;
+        } else if (entry->last_used < oldest->last_used) {
+            oldest = entry;
+        }
+    }
+
+    if (oldest->texture) SDL_DestroyTexture(oldest->texture);
+    oldest->texture = NULL;
+
+    SDL_Surface* surf = TTF_RenderText_Solid(atlas->font, text, color);
+    if (!surf) return NULL;
+
+    oldest->texture = SDL_CreateTextureFromSurface(renderer, surf);
+    oldest->w = surf->w;
+    oldest->h = surf->h;
+    SDL_FreeSurface(surf);
+    if (!oldest->texture) return NULL;
+
+    oldest->atlas = atlas;
+    oldest->color = color;
+    strcpy(oldest->text, text);
+    oldest->last_used = cache->uses;
+    return oldest;
+}
+
+void textCacheFree(struct TextCache* cache) {
+    for (size_t i = 0; i < TEXT_CACHE_SIZE; i++) {
+        if (cache->entries[i].texture) SDL_DestroyTexture(cache->entries[i].texture);
+        cache->entries[i].texture = NULL;
+    }
+}
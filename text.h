@@ -0,0 +1,73 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#else
+#include <SDL.h>
+#include <SDL_ttf.h>
+#endif
+
+// Printable ASCII, anything else is drawn as '?'
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST '~'
+#define GLYPHS_SIZE (GLYPH_LAST - GLYPH_FIRST + 1)
+// Glyphs are packed in rows up to this wide
+#define GLYPH_ATLAS_WIDTH 512
+
+#define TEXT_CACHE_SIZE 32
+// Longer strings aren't cached
+#define CACHED_TEXT_SIZE 64
+
+/*
+ * Every glyph of a font rasterized once, in white, into one texture. A
+ * string is then drawn as a quad per glyph in a single SDL_RenderGeometry,
+ * with the colour given to the vertices.
+ * */
+struct GlyphAtlas {
+    TTF_Font* font;
+    SDL_Texture* texture;
+    int texture_w;
+    int texture_h;
+
+    SDL_Rect glyphs[GLYPHS_SIZE];
+    int advances[GLYPHS_SIZE];
+    // Added between a glyph and the next
+    int8_t kerning[GLYPHS_SIZE][GLYPHS_SIZE];
+    int height;
+};
+
+/*
+ * Strings that are the same from frame to frame, like menu buttons, rendered
+ * once each into a texture of their own. The least recently used one makes
+ * room for a new one.
+ * */
+struct CachedText {
+    struct GlyphAtlas* atlas;
+    SDL_Color color;
+    char text[CACHED_TEXT_SIZE];
+
+    SDL_Texture* texture;
+    int w;
+    int h;
+    uint64_t last_used;
+};
+
+struct TextCache {
+    struct CachedText entries[TEXT_CACHE_SIZE];
+    uint64_t uses;
+};
+
+bool glyphAtlasInit(struct GlyphAtlas* atlas, SDL_Renderer* renderer, TTF_Font* font);
+void glyphAtlasFree(struct GlyphAtlas* atlas);
+void glyphAtlasSize(struct GlyphAtlas* atlas, char* text, int* w, int* h);
+void glyphAtlasDraw(struct GlyphAtlas* atlas, SDL_Renderer* renderer, char* text, int x, int y, SDL_Color color);
+
+struct CachedText* textCacheGet(struct TextCache* cache, SDL_Renderer* renderer, struct GlyphAtlas* atlas, char* text, SDL_Color color);
+void textCacheFree(struct TextCache* cache);
+
+#endif // TEXT_H
@@ -0,0 +1,33 @@
+#include "tribuf.h"
+
+#define TRIPLE_BUFFER_NEW 0x4
+#define TRIPLE_BUFFER_SLOT 0x3
+
+void tripleBufferInit(struct TripleBuffer* buffer) {
+    buffer->front = 0;
+    buffer->middle = 1;
+    buffer->back = 2;
+}
+
+uint32_t tripleBufferBack(struct TripleBuffer* buffer) {
+    return buffer->back;
+}
+
+// The back slot's writes happen before the reader takes it, and the middle
+// slot's reads by the reader happened before it's written again
+void tripleBufferPublish(struct TripleBuffer* buffer) {
+    uint32_t old = __atomic_exchange_n(&buffer->middle, buffer->back | TRIPLE_BUFFER_NEW, __ATOMIC_ACQ_REL);
+    buffer->back = old & TRIPLE_BUFFER_SLOT;
+}
+
+bool tripleBufferUpdate(struct TripleBuffer* buffer) {
+    if (!(__atomic_load_n(&buffer->middle, __ATOMIC_RELAXED) & TRIPLE_BUFFER_NEW)) return false;
+
+    uint32_t old = __atomic_exchange_n(&buffer->middle, buffer->front, __ATOMIC_ACQ_REL);
+    buffer->front = old & TRIPLE_BUFFER_SLOT;
+    return true;
+}
+
+uint32_t tripleBufferFront(struct TripleBuffer* buffer) {
+    return buffer->front;
+}
@@ -0,0 +1,34 @@
+#ifndef TRIBUF_H
+#define TRIBUF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Which of three slots a writer and a reader each own, for handing the
+ * newest of something from one thread to another without a lock. The
+ * writer fills its back slot and publishes it, swapping it for the middle
+ * one. The reader swaps its front slot for the middle one when something
+ * new was published since it last did, so it always has the newest
+ * complete slot, and neither ever waits for the other. The slots themselves
+ * are the caller's, indexed 0 to 2.
+ * */
+struct TripleBuffer {
+    // The middle slot, with TRIPLE_BUFFER_NEW set until the reader takes it
+    _Alignas(64) uint32_t middle;
+    // Only the writer's
+    _Alignas(64) uint32_t back;
+    // Only the reader's
+    _Alignas(64) uint32_t front;
+};
+
+void tripleBufferInit(struct TripleBuffer* buffer);
+
+uint32_t tripleBufferBack(struct TripleBuffer* buffer);
+void tripleBufferPublish(struct TripleBuffer* buffer);
+
+// False and front stays if nothing was published since
+bool tripleBufferUpdate(struct TripleBuffer* buffer);
+uint32_t tripleBufferFront(struct TripleBuffer* buffer);
+
+#endif // TRIBUF_H
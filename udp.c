@@ -0,0 +1,140 @@
+#if defined(__linux__)
+// sendmmsg, recvmmsg
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+
+#include "udp.h"
+
+// Bound to port on every address (0 for any port) and non blocking, -1 if it failed
+int udpOpen(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        closeFd(fd);
+        return -1;
+    }
+
+    unblock(fd);
+    return fd;
+}
+
+void udpBatchInit(struct UdpBatch* batch, bool batched) {
+    memset(batch, 0, sizeof(*batch));
+    batch->batched = batched;
+
+#if defined(__linux__)
+    for (size_t i = 0; i < UDP_BATCH_SIZE; i++) {
+        batch->iovs[i].iov_base = batch->packets[i].data;
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->packets[i].addr;
+    }
+#endif // defined
+}
+
+// The next packet to fill in, NULL once the batch is full and must be sent
+struct UdpPacket* udpBatchAdd(struct UdpBatch* batch, struct sockaddr_in* addr) {
+    if (batch->size == UDP_BATCH_SIZE) return NULL;
+
+    struct UdpPacket* packet = &batch->packets[batch->size++];
+    packet->addr = *addr;
+    packet->size = 0;
+    return packet;
+}
+
+static bool udpWouldBlock() {
+#if defined(__linux__)
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#elif defined(WINDOWS)
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#endif // defined
+}
+
+/*
+ * Send everything added since the last call and empty the batch. Returns how
+ * many packets the socket took: datagrams that don't fit in its buffer are
+ * lost, like on the network.
+ * */
+size_t udpBatchSend(struct UdpBatch* batch, int fd) {
+    size_t sent = 0;
+
+#if defined(__linux__)
+    if (batch->batched) {
+        for (size_t i = 0; i < batch->size; i++) {
+            batch->iovs[i].iov_len = batch->packets[i].size;
+            batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        while (sent < batch->size) {
+            int ret = sendmmsg(fd, &batch->msgs[sent], batch->size - sent, 0);
+            batch->syscalls++;
+            if (ret <= 0) break;
+
+            sent += ret;
+        }
+
+        batch->size = 0;
+        return sent;
+    }
+#endif // defined
+
+    for (size_t i = 0; i < batch->size; i++) {
+        struct UdpPacket* packet = &batch->packets[i];
+        int ret = sendto(fd, (char*)packet->data, packet->size, 0, (struct sockaddr*)&packet->addr, sizeof(packet->addr));
+        batch->syscalls++;
+        if (ret >= 0) {
+            sent++;
+        } else if (!udpWouldBlock()) {
+            break;
+        }
+    }
+
+    batch->size = 0;
+    return sent;
+}
+
+// Fill the batch with what's waiting, up to UDP_BATCH_SIZE. Returns how many.
+size_t udpBatchRecv(struct UdpBatch* batch, int fd) {
+    batch->size = 0;
+
+#if defined(__linux__)
+    if (batch->batched) {
+        for (size_t i = 0; i < UDP_BATCH_SIZE; i++) {
+            batch->iovs[i].iov_len = UDP_PACKET_SIZE;
+            batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+
+        int ret = recvmmsg(fd, batch->msgs, UDP_BATCH_SIZE, 0, NULL);
+        batch->syscalls++;
+        if (ret <= 0) return 0;
+
+        for (int i = 0; i < ret; i++) {
+            batch->packets[i].size = batch->msgs[i].msg_len;
+        }
+        batch->size = ret;
+        return batch->size;
+    }
+#endif // defined
+
+    while (batch->size < UDP_BATCH_SIZE) {
+        struct UdpPacket* packet = &batch->packets[batch->size];
+        socklen_t addr_len = sizeof(packet->addr);
+        int ret = recvfrom(fd, (char*)packet->data, UDP_PACKET_SIZE, 0, (struct sockaddr*)&packet->addr, &addr_len);
+        batch->syscalls++;
+        if (ret < 0) break;
+
+        packet->size = ret;
+        batch->size++;
+    }
+
+    return batch->size;
+}
@@ -0,0 +1,51 @@
+#ifndef UDP_H
+#define UDP_H
+
+#include "net.h"
+
+#if defined(__linux__)
+#include <sys/uio.h>
+#endif
+
+// Packets going out or coming in with one call
+#define UDP_BATCH_SIZE 64
+// Fits in one Ethernet frame with room for IP and UDP headers
+#define UDP_PACKET_SIZE 1200
+
+struct UdpPacket {
+    struct sockaddr_in addr;
+    size_t size;
+    uint8_t data[UDP_PACKET_SIZE];
+};
+
+/*
+ * Datagram I/O in batches, for a server with many clients. Packets are
+ * written into a batch kept around between ticks, and a full batch goes out
+ * in one sendmmsg (or comes in with one recvmmsg) on Linux, with the message
+ * vectors pointing into the packets set up once in udpBatchInit.
+ *
+ * Without batched set, or off Linux, it's a sendto or recvfrom per packet.
+ * On Linux, _GNU_SOURCE must be defined before any include for mmsghdr.
+ * */
+struct UdpBatch {
+    struct UdpPacket packets[UDP_BATCH_SIZE];
+    size_t size;
+    bool batched;
+
+    // Calls made, for comparing both ways
+    uint64_t syscalls;
+
+#if defined(__linux__)
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    struct iovec iovs[UDP_BATCH_SIZE];
+#endif
+};
+
+int udpOpen(uint16_t port);
+
+void udpBatchInit(struct UdpBatch* batch, bool batched);
+struct UdpPacket* udpBatchAdd(struct UdpBatch* batch, struct sockaddr_in* addr);
+size_t udpBatchSend(struct UdpBatch* batch, int fd);
+size_t udpBatchRecv(struct UdpBatch* batch, int fd);
+
+#endif // UDP_H
@@ -0,0 +1,235 @@
+/*
+ * udpbench: how much batching datagrams saves a server with many clients.
+ *
+ * Simulated clients on loopback each send the server an input every tick,
+ * and the server reads them all and answers each with a state, first with a
+ * recvfrom/sendto per packet, then with recvmmsg/sendmmsg batches. Only the
+ * server's side is timed. The report has packets per second of server time
+ * and the CPU time and system calls it took per tick, for both ways.
+ * */
+#if defined(__linux__)
+// clock_gettime, and struct mmsghdr for udp.h
+#define _GNU_SOURCE
+#include <time.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "udp.h"
+
+// Server socket buffers, enough for a tick's worth of packets
+#define BENCH_SOCKET_BUFF (8*1024*1024)
+// As big as MSG_INPUT with one input in it
+#define BENCH_INPUT_SIZE 16
+
+struct Options {
+    size_t clients;
+    size_t ticks;
+    size_t state_size;
+} options = {
+    .clients = 1000,
+    .ticks = 1000,
+    .state_size = 200,
+};
+
+struct Result {
+    uint64_t wall_us;
+    uint64_t cpu_us;
+    uint64_t packets_in;
+    uint64_t packets_out;
+    uint64_t syscalls;
+    uint64_t lost;
+};
+
+void usage(char* program) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "\n"
+        "    --clients N          simulated clients (default 1000)\n"
+        "    --ticks N            ticks to run each way (default 1000)\n"
+        "    --state-size BYTES   state packet sent to each client every tick (default 200)\n",
+        program
+    );
+    exit(EXIT_FAILURE);
+}
+
+uint32_t parseNum(char* program, char* str, uint32_t min, uint32_t max) {
+    char* end;
+    long num = strtol(str, &end, 10);
+
+    if (*str == '\0' || *end != '\0' || num < (long)min || (unsigned long)num > max) {
+        fprintf(stderr, "Invalid number: %s\n", str);
+        usage(program);
+    }
+
+    return num;
+}
+
+// CPU time of the whole process, user and system
+uint64_t cpuNowUs() {
+#if defined(__linux__)
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#elif defined(WINDOWS)
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10;
+#endif // defined
+}
+
+// Where fd was bound, as seen from this machine
+struct sockaddr_in localAddr(int fd) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    pcr(getsockname(fd, (struct sockaddr*)&addr, &addr_len), "getsockname failed");
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+void bigBuffers(int fd) {
+    int size = BENCH_SOCKET_BUFF;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char*)&size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char*)&size, sizeof(size));
+}
+
+void benchRun(bool batched, struct Result* result) {
+    memset(result, 0, sizeof(*result));
+
+    int server_fd = udpOpen(0);
+    pcr(server_fd, "Server socket failed");
+    bigBuffers(server_fd);
+    struct sockaddr_in server_addr = localAddr(server_fd);
+
+    int* client_fds = pcp(malloc(options.clients*sizeof(int)), "malloc failed");
+    struct sockaddr_in* client_addrs = pcp(malloc(options.clients*sizeof(struct sockaddr_in)), "malloc failed");
+    for (size_t i = 0; i < options.clients; i++) {
+        client_fds[i] = udpOpen(0);
+        pcr(client_fds[i], "Client socket failed");
+        client_addrs[i] = localAddr(client_fds[i]);
+    }
+
+    // Static, they're too big for the stack
+    static struct UdpBatch in;
+    static struct UdpBatch out;
+    udpBatchInit(&in, batched);
+    udpBatchInit(&out, batched);
+
+    uint8_t input[BENCH_INPUT_SIZE] = {0};
+    uint8_t buff[UDP_PACKET_SIZE];
+
+    for (size_t tick = 0; tick < options.ticks; tick++) {
+        for (size_t i = 0; i < options.clients; i++) {
+            sendto(client_fds[i], (char*)input, sizeof(input), 0, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        }
+
+        uint64_t wall_start = netNowUs();
+        uint64_t cpu_start = cpuNowUs();
+
+        size_t received;
+        while ((received = udpBatchRecv(&in, server_fd)) > 0) {
+            result->packets_in += received;
+        }
+
+        for (size_t i = 0; i < options.clients; i++) {
+            struct UdpPacket* packet = udpBatchAdd(&out, &client_addrs[i]);
+            if (!packet) {
+                result->packets_out += udpBatchSend(&out, server_fd);
+                packet = udpBatchAdd(&out, &client_addrs[i]);
+            }
+
+            memset(packet->data, tick, options.state_size);
+            packet->size = options.state_size;
+        }
+        result->packets_out += udpBatchSend(&out, server_fd);
+
+        result->wall_us += netNowUs() - wall_start;
+        result->cpu_us += cpuNowUs() - cpu_start;
+
+        // Clients take their states, so their buffers never fill
+        for (size_t i = 0; i < options.clients; i++) {
+            while (recv(client_fds[i], (char*)buff, sizeof(buff), 0) > 0);
+        }
+    }
+
+    result->syscalls = in.syscalls + out.syscalls;
+    result->lost = options.clients*options.ticks*2 - result->packets_in - result->packets_out;
+
+    for (size_t i = 0; i < options.clients; i++) closeFd(client_fds[i]);
+    closeFd(server_fd);
+    free(client_fds);
+    free(client_addrs);
+}
+
+void printResult(char* name, struct Result* result) {
+    uint64_t packets = result->packets_in + result->packets_out;
+
+    printf("%-10s %10.0f %14.1f %14.1f %16.1f %8"PRIu64"\n",
+        name,
+        result->wall_us ? packets * 1000000.0 / result->wall_us : 0.0,
+        (double)result->wall_us / options.ticks,
+        (double)result->cpu_us / options.ticks,
+        (double)result->syscalls / options.ticks,
+        result->lost);
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) usage(argv[0]);
+
+        char* opt = argv[i];
+        char* value = argv[++i];
+
+        if (strcmp(opt, "--clients") == 0) {
+            options.clients = parseNum(argv[0], value, 1, 100000);
+        } else if (strcmp(opt, "--ticks") == 0) {
+            options.ticks = parseNum(argv[0], value, 1, 1000000);
+        } else if (strcmp(opt, "--state-size") == 0) {
+            options.state_size = parseNum(argv[0], value, 1, UDP_PACKET_SIZE);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", opt);
+            usage(argv[0]);
+        }
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+#ifdef WINDOWS
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != NO_ERROR) {
+        fprintf(stderr, "WSAStartup failed: %d\n", WSAGetLastError());
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    printf("%zu clients, %zu ticks, %zu byte states\n\n", options.clients, options.ticks, options.state_size);
+    printf("%-10s %10s %14s %14s %16s %8s\n", "", "packets/s", "wall us/tick", "cpu us/tick", "syscalls/tick", "lost");
+
+    struct Result single;
+    benchRun(false, &single);
+    printResult("single", &single);
+
+#if defined(__linux__)
+    struct Result batched;
+    benchRun(true, &batched);
+    printResult("batched", &batched);
+
+    if (single.cpu_us > 0) {
+        printf("\nbatched takes %.2fx the CPU time of single\n", (double)batched.cpu_us / single.cpu_us);
+    }
+#else
+    printf("batched    not available on this system\n");
+#endif // defined
+
+#ifdef WINDOWS
+    WSACleanup();
+#endif
+
+    return 0;
+}
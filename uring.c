@@ -0,0 +1,430 @@
+#if defined(__linux__)
+// syscall, MAP_POPULATE
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+
+#include "uring.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+enum UringOp {
+    URING_RECV,
+    URING_SEND,
+    URING_ACCEPT,
+    URING_TIMEOUT,
+    URING_CANCEL,
+};
+
+/*
+ * A request's user_data is its op, the slot it's for and the slot's
+ * generation, so a cancel never hits the read of the slot's next connection.
+ * */
+#define URING_DATA(op, slot_i, gen) ((uint64_t)(gen) << 32 | (uint64_t)(slot_i) << 8 | (op))
+#define URING_DATA_OP(data) ((data) & 0xff)
+#define URING_DATA_SLOT(data) (((data) >> 8) & 0xffffff)
+
+struct UringSlot {
+    struct Uring* ring;
+    // NULL once the connection is closed, the slot is free when its
+    // requests are done too
+    struct Conn* conn;
+    int fd;
+    bool used;
+    uint32_t gen;
+    // Requests in flight
+    uint32_t ops;
+    bool recving;
+    bool sending;
+
+    uint8_t* recv_buff;
+    uint8_t* send_buff;
+    size_t send_size;
+};
+
+struct Uring {
+    int fd;
+
+    void* ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t sq_mask;
+    uint32_t* sq_array;
+    uint32_t sq_entries;
+    // Queued since the last io_uring_enter
+    uint32_t to_submit;
+
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+    uint32_t cq_entries;
+
+    uint8_t* arena;
+    size_t arena_size;
+    struct UringSlot* slots;
+    size_t slots_size;
+
+    int listen_fd;
+    void (*on_accept)(int fd);
+    // One accept taking every connection, until the kernel says it can't
+    bool accept_multishot;
+
+    bool timeout_pending;
+    struct __kernel_timespec timeout;
+};
+
+static int uringEnter(struct Uring* ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    net_syscalls++;
+    return syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void uringSubmit(struct Uring* ring) {
+    if (ring->to_submit == 0) return;
+
+    int ret = uringEnter(ring, ring->to_submit, 0, 0);
+    if (ret > 0) ring->to_submit -= ret;
+}
+
+// Submits what's queued when the queue is full
+static struct io_uring_sqe* uringSqe(struct Uring* ring) {
+    uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = *ring->sq_tail;
+    if (tail - head == ring->sq_entries) {
+        uringSubmit(ring);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head == ring->sq_entries) return NULL;
+    }
+
+    uint32_t i = tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[i] = i;
+
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+    return sqe;
+}
+
+static void uringSlotFree(struct UringSlot* slot) {
+    if (slot->conn || slot->ops > 0) return;
+
+    slot->used = false;
+    slot->gen++;
+}
+
+static void uringRecv(struct UringSlot* slot) {
+    struct io_uring_sqe* sqe = uringSqe(slot->ring);
+    if (!sqe) {
+        fprintf(stderr, "io_uring queue full, dropping connection\n");
+        connClose(slot->conn);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)slot->recv_buff;
+    sqe->len = URING_RECV_SIZE;
+    sqe->buf_index = 0;
+    sqe->user_data = URING_DATA(URING_RECV, slot - slot->ring->slots, slot->gen);
+
+    slot->ops++;
+    slot->recving = true;
+}
+
+static void uringAccept(struct Uring* ring) {
+    struct io_uring_sqe* sqe = uringSqe(ring);
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = ring->listen_fd;
+    if (ring->accept_multishot) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_DATA(URING_ACCEPT, 0, 0);
+}
+
+static int uringConnWrite(void* ctx, uint8_t* data, size_t data_size) {
+    struct UringSlot* slot = ctx;
+
+    size_t free_size = URING_SEND_SIZE - slot->send_size;
+    if (data_size > free_size) data_size = free_size;
+
+    memcpy(&slot->send_buff[slot->send_size], data, data_size);
+    slot->send_size += data_size;
+    return data_size;
+}
+
+static void uringCancel(struct UringSlot* slot, enum UringOp op) {
+    struct io_uring_sqe* sqe = uringSqe(slot->ring);
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_DATA(op, slot - slot->ring->slots, slot->gen);
+    sqe->user_data = URING_DATA(URING_CANCEL, 0, 0);
+}
+
+static void uringConnClose(void* ctx) {
+    struct UringSlot* slot = ctx;
+    slot->conn = NULL;
+
+    // The socket is blocking, so a read waits forever, and a write to a
+    // client that stopped reading does too. The socket is only really
+    // closed once the kernel lets go of it.
+    if (slot->recving) uringCancel(slot, URING_RECV);
+    if (slot->sending) uringCancel(slot, URING_SEND);
+
+    uringSlotFree(slot);
+}
+
+static const struct ConnIo uring_conn_io = {
+    .write = uringConnWrite,
+    .close = uringConnClose,
+};
+
+struct Uring* uringInit(size_t conns_size, int listen_fd, void (*on_accept)(int fd)) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // A read, a write and a cancel for each per connection, an accept and
+    // the timer
+    int fd = syscall(__NR_io_uring_setup, conns_size*4 + 2, &params);
+    if (fd < 0) return NULL;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        closeFd(fd);
+        return NULL;
+    }
+
+    struct Uring* ring = pcp(calloc(1, sizeof(*ring)), "calloc failed");
+    ring->fd = fd;
+    ring->listen_fd = listen_fd;
+    ring->on_accept = on_accept;
+    ring->accept_multishot = true;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries*sizeof(uint32_t);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->ring_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->ring_ptr != MAP_FAILED) munmap(ring->ring_ptr, ring->ring_size);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        closeFd(fd);
+        free(ring);
+        return NULL;
+    }
+
+    uint8_t* ptr = ring->ring_ptr;
+    ring->sq_head = (uint32_t*)(ptr + params.sq_off.head);
+    ring->sq_tail = (uint32_t*)(ptr + params.sq_off.tail);
+    ring->sq_mask = *(uint32_t*)(ptr + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(ptr + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (uint32_t*)(ptr + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(ptr + params.cq_off.tail);
+    ring->cq_mask = *(uint32_t*)(ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ptr + params.cq_off.cqes);
+    ring->cq_entries = params.cq_entries;
+
+    // Registered once, so reads and writes don't map their pages every time
+    ring->slots_size = conns_size;
+    ring->slots = pcp(calloc(conns_size, sizeof(struct UringSlot)), "calloc failed");
+    ring->arena_size = conns_size*(URING_RECV_SIZE + URING_SEND_SIZE);
+    ring->arena = mmap(NULL, ring->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    struct iovec iov = {.iov_base = ring->arena, .iov_len = ring->arena_size};
+    if (ring->arena == MAP_FAILED || syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+        if (ring->arena != MAP_FAILED) munmap(ring->arena, ring->arena_size);
+        ring->arena = NULL;
+        uringClose(ring);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < conns_size; i++) {
+        struct UringSlot* slot = &ring->slots[i];
+        slot->ring = ring;
+        slot->recv_buff = &ring->arena[i*(URING_RECV_SIZE + URING_SEND_SIZE)];
+        slot->send_buff = slot->recv_buff + URING_RECV_SIZE;
+    }
+
+    uringAccept(ring);
+    return ring;
+}
+
+void uringClose(struct Uring* ring) {
+    if (ring->arena) munmap(ring->arena, ring->arena_size);
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_ptr, ring->ring_size);
+    closeFd(ring->fd);
+    free(ring->slots);
+    free(ring);
+}
+
+/*
+ * The connection's socket must be blocking, or its reads would fail right
+ * away instead of waiting in the kernel.
+ * */
+bool uringAttach(struct Uring* ring, struct Conn* conn) {
+    for (size_t i = 0; i < ring->slots_size; i++) {
+        struct UringSlot* slot = &ring->slots[i];
+        if (slot->used) continue;
+
+        slot->used = true;
+        slot->conn = conn;
+        slot->fd = conn->fd;
+        slot->ops = 0;
+        slot->recving = false;
+        slot->sending = false;
+        slot->send_size = 0;
+
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL, 0) & ~O_NONBLOCK);
+        connSetIo(conn, &uring_conn_io, slot);
+        uringRecv(slot);
+        return true;
+    }
+
+    return false;
+}
+
+// Queue a write of what each connection wrote since its last one was done
+void uringFlush(struct Uring* ring) {
+    for (size_t i = 0; i < ring->slots_size; i++) {
+        struct UringSlot* slot = &ring->slots[i];
+        if (!slot->conn || slot->sending || slot->send_size == 0) continue;
+
+        struct io_uring_sqe* sqe = uringSqe(ring);
+        if (!sqe) return;
+
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = slot->fd;
+        sqe->addr = (uint64_t)(uintptr_t)slot->send_buff;
+        sqe->len = slot->send_size;
+        sqe->buf_index = 0;
+        sqe->user_data = URING_DATA(URING_SEND, i, slot->gen);
+
+        slot->ops++;
+        slot->sending = true;
+    }
+}
+
+static void uringComplete(struct Uring* ring, struct io_uring_cqe* cqe) {
+    struct UringSlot* slot = &ring->slots[URING_DATA_SLOT(cqe->user_data)];
+
+    switch (URING_DATA_OP(cqe->user_data)) {
+        case URING_RECV: {
+            slot->ops--;
+            slot->recving = false;
+
+            if (slot->conn) {
+                if (cqe->res > 0) {
+                    if (connFeed(slot->conn, slot->recv_buff, cqe->res)) uringRecv(slot);
+                } else {
+                    // Closed by the other end, or broken
+                    connClose(slot->conn);
+                }
+            }
+            uringSlotFree(slot);
+        } break;
+        case URING_SEND: {
+            slot->ops--;
+            slot->sending = false;
+
+            if (cqe->res < 0) {
+                if (slot->conn) connClose(slot->conn);
+            } else {
+                slot->send_size -= cqe->res;
+                memmove(slot->send_buff, &slot->send_buff[cqe->res], slot->send_size);
+            }
+            uringSlotFree(slot);
+        } break;
+        case URING_ACCEPT: {
+            if (cqe->res == -EINVAL && ring->accept_multishot) {
+                ring->accept_multishot = false;
+            } else if (cqe->res >= 0) {
+                ring->on_accept(cqe->res);
+            }
+            if (!(cqe->flags & IORING_CQE_F_MORE)) uringAccept(ring);
+        } break;
+        case URING_TIMEOUT: {
+            ring->timeout_pending = false;
+        } break;
+        case URING_CANCEL: {
+        } break;
+    }
+}
+
+/*
+ * Submit what was queued and sleep until timeout has passed, handling what
+ * completed meanwhile. Completions don't wake it up early, they're handled
+ * together once the timer goes off.
+ * */
+void uringWait(struct Uring* ring, uint32_t timeout) {
+    if (!ring->timeout_pending) {
+        struct io_uring_sqe* sqe = uringSqe(ring);
+        if (sqe) {
+            ring->timeout.tv_sec = timeout / 1000;
+            ring->timeout.tv_nsec = (long long)(timeout % 1000) * 1000000;
+
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)&ring->timeout;
+            sqe->len = 1;
+            sqe->user_data = URING_DATA(URING_TIMEOUT, 0, 0);
+            ring->timeout_pending = true;
+        }
+    }
+
+    // A timeout completing wakes the wait up however few completions there are
+    int ret = uringEnter(ring, ring->to_submit, ring->cq_entries, IORING_ENTER_GETEVENTS);
+    if (ret > 0) ring->to_submit -= ret;
+
+    uint32_t head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        // Copied, handling it may complete more
+        struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+        head++;
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        uringComplete(ring, &cqe);
+    }
+}
+
+#else
+
+struct Uring* uringInit(size_t conns_size, int listen_fd, void (*on_accept)(int fd)) {
+    (void)conns_size;
+    (void)listen_fd;
+    (void)on_accept;
+    return NULL;
+}
+
+void uringClose(struct Uring* ring) {
+    (void)ring;
+}
+
+bool uringAttach(struct Uring* ring, struct Conn* conn) {
+    (void)ring;
+    (void)conn;
+    return false;
+}
+
+void uringFlush(struct Uring* ring) {
+    (void)ring;
+}
+
+void uringWait(struct Uring* ring, uint32_t timeout) {
+    (void)ring;
+    (void)timeout;
+}
+
+#endif // defined
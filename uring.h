@@ -0,0 +1,32 @@
+#ifndef URING_H
+#define URING_H
+
+#include "net.h"
+
+// Registered buffer space per connection, received and waiting to be sent
+#define URING_RECV_SIZE 2048
+#define URING_SEND_SIZE 4096
+
+/*
+ * Socket I/O for a server's connections through io_uring, Linux only.
+ *
+ * Every connection attached to it has a slot of one buffer arena registered
+ * with the kernel once, and always has a read of it in flight. What's read
+ * is fed to the connection, and what it writes is copied to the slot and
+ * sent with one write per connection from uringFlush. Accepting on the
+ * listening socket and the timer that wakes it up for the next tick are
+ * requests like the others, so uringWait hands the kernel all of a tick's
+ * requests and waits for the next with a single call.
+ * */
+struct Uring;
+
+// on_accept is called from uringWait for every new connection, with its socket
+struct Uring* uringInit(size_t conns_size, int listen_fd, void (*on_accept)(int fd));
+void uringClose(struct Uring* ring);
+
+// False when all slots are taken, the connection isn't changed
+bool uringAttach(struct Uring* ring, struct Conn* conn);
+void uringFlush(struct Uring* ring);
+void uringWait(struct Uring* ring, uint32_t timeout);
+
+#endif // URING_H